@@ -11,41 +11,94 @@
 #include "mmer.h"
 #include "kmc_file.h"
 #include <tuple>
+#include <thread>
+#include <atomic>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#endif
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define KMC_SCAN_X86
+#endif
 
 
 uint64 CKMCFile::part_size = 1 << 25;
 
+static uint64 AlignUp(uint64 x, uint64 alignment)
+{
+	return (x + alignment - 1) / alignment * alignment;
+}
+
 
 // ----------------------------------------------------------------------------------
-// Open files *.kmc_pre & *.kmc_suf, read them to RAM, close files. 
-// The file *.kmc_suf is opened for random access
+// Open files *.kmc_pre & *.kmc_suf, read them to RAM (or map *.kmc_suf, see SetLoadFlags),
+// close files. The file *.kmc_suf is opened for random access
 // IN	: file_name - the name of kmer_counter's output
 // RET	: true		- if successful
 // ----------------------------------------------------------------------------------
-bool CKMCFile::OpenForRA(const std::string &file_name)
+bool CKMCFile::OpenForRA(const std::string &file_name, suffix_layout layout)
 {
 	uint64 size;
-	size_t result;
 
 	if (file_pre || file_suf)
 		return false;
 
-	if (!OpenASingleFile(file_name + ".kmc_pre", file_pre, size, (char *)"KMCP"))
-		return false;
-
-	ReadParamsFrom_prefix_file_buf(size, open_mode::opened_for_RA);
-
-	if (!OpenASingleFile(file_name + ".kmc_suf", file_suf, size, (char *)"KMCS"))
+	if (!OpenASingleFile(file_name + ".kmc_pre", file_pre, size, (char *)"KMCP") ||
+		!ReadParamsFrom_prefix_file_buf(size, open_mode::opened_for_RA) ||
+		!OpenASingleFile(file_name + ".kmc_suf", file_suf, size, (char *)"KMCS"))
+	{
+		ReleaseAll();
 		return false;
+	}
 
-	sufix_file_buf = new uchar[size];
-	result = fread(sufix_file_buf, 1, size, file_suf);
-	if (result != size)
+	bool loaded;
+	if (layout == layout_compressed)
+	{
+		loaded = ReadEliasFanoSufixes();
+		sufix_loaded = loaded_elias_fano;
+	}
+	else if (sufix_load & load_presence_only)
+	{
+		loaded = ReadCompactSufixes();
+		sufix_loaded = loaded_compacted;
+	}
+	else if ((sufix_load & load_mmap) && MapSufixFile(size, layout == layout_eytzinger))
+	{
+		loaded = true;
+		sufix_loaded = sufix_load & load_populate ? loaded_populated : loaded_mapped;
+	}
+	else
+	{
+		sufix_file_buf = (uchar*)AllocateArea(size + SUFIX_PADDING, sufix_area);
+		loaded = sufix_file_buf && ReadParallel(file_suf, 4, sufix_file_buf, size);
+		sufix_loaded = loaded_read;
+	}
+	if (!loaded)
+	{
+		ReleaseAll();
 		return false;
+	}
 
 	fclose(file_suf);
 	file_suf = NULL;
 
+	sufix_layout = layout;
+	if (sufix_layout == layout_eytzinger)
+		RelayoutSufixBuckets();
+
 	is_opened = opened_for_RA;
 	prefix_index = 0;
 	sufix_number = 0;
@@ -71,7 +124,11 @@ bool CKMCFile::OpenForListing(const std::string &file_name)
 	if (!OpenASingleFile(file_name + ".kmc_pre", file_pre, size, (char *)"KMCP"))
 		return false;
 
-	ReadParamsFrom_prefix_file_buf(size, open_mode::opened_for_listing);
+	if (!ReadParamsFrom_prefix_file_buf(size, open_mode::opened_for_listing))
+	{
+		ReleaseAll();
+		return false;
+	}
 
 	end_of_file = total_kmers == 0;
 
@@ -118,13 +175,685 @@ CKMCFile::~CKMCFile()
 		fclose(file_pre);
 	if (file_suf)
 		fclose(file_suf);
-	if (prefix_file_buf)
-		delete[] prefix_file_buf;
-	if (sufix_file_buf)
-		delete[] sufix_file_buf;
+	ReleaseSharedSegment();
+	FreeArea(prefix_area);
+	ReleaseSufixBuffer();
 	if (signature_map)
 		delete[] signature_map;
 }
+//----------------------------------------------------------------------------------
+// Read a part of a file with pread from up to load_threads threads, each on a disjoint
+// range of at least 64 MB, so that the page faults of a fresh buffer are spread over
+// the threads too. Auxiliary function.
+// IN	: offset, size	- the part of the file
+// OUT	: buf			- size bytes
+// RET	: true			- if successful
+//----------------------------------------------------------------------------------
+bool CKMCFile::ReadParallel(FILE* file, uint64 offset, void* buf, uint64 size) const
+{
+#ifndef _WIN32
+	const uint64 min_range = 1ull << 26;
+	uint64 threads = MIN((uint64)load_threads, (size + min_range - 1) / min_range);
+	if (threads <= 1)
+	{
+		my_fseek(file, offset, SEEK_SET);
+		return fread(buf, 1, size, file) == size;
+	}
+
+	int fd = fileno(file);
+	std::atomic<bool> ok(true);
+	auto read_range = [&](uint64 begin, uint64 end) {
+		while (begin < end && ok)
+		{
+			ssize_t readed = pread(fd, (uchar*)buf + begin, MIN(end - begin, 1ull << 30), offset + begin);
+			if (readed < 0 && errno == EINTR)
+				continue;
+			if (readed <= 0)
+				ok = false;
+			else
+				begin += readed;
+		}
+	};
+	uint64 range = (size / threads + 4095) / 4096 * 4096;
+	std::vector<std::thread> workers;
+	for (uint64 begin = range; begin < size; begin += range)
+		workers.emplace_back(read_range, begin, MIN(begin + range, size));
+	read_range(0, MIN(range, size));
+	for (auto& worker : workers)
+		worker.join();
+	return ok;
+#else
+	my_fseek(file, offset, SEEK_SET);
+	return fread(buf, 1, size, file) == size;
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Read *.kmc_suf in parts of about 256 MB, copying only the suffixes of records whose
+// counters are within [max(load_min_count, min_count), max_count]. The LUT is renumbered
+// to the kept records, total_kmers becomes their number and counter_size becomes 0, so
+// that sufix_rec_size == sufix_size for every search. Auxiliary function.
+// RET	: true - if successful
+//----------------------------------------------------------------------------------
+bool CKMCFile::ReadCompactSufixes()
+{
+	if (load_min_count > min_count && load_min_count <= max_count)
+		min_count = load_min_count;
+
+	uint64 part_records = std::max<uint64>(1, MIN((1ull << 28) / std::max<uint32>(sufix_rec_size, 1), total_kmers));
+	std::vector<uchar> part(part_records * sufix_rec_size);
+	sufix_file_buf = (uchar*)AllocateArea(total_kmers * sufix_size + SUFIX_PADDING, sufix_area);
+	if (!sufix_file_buf)
+		return false;
+
+	uint64 last_data_index = prefix_file_buf_size - 1;
+	uint64 lut_pos = 0, kept = 0;
+	for (uint64 record = 0; record < total_kmers;)
+	{
+		uint64 n = MIN(part_records, total_kmers - record);
+		if (!ReadParallel(file_suf, 4 + record * sufix_rec_size, part.data(), n * sufix_rec_size))
+			return false;
+		for (uint64 i = 0; i < n; ++i, ++record)
+		{
+			//buckets starting at this record start at the next kept one
+			for (; lut_pos < last_data_index && prefix_file_buf[lut_pos] <= record; ++lut_pos)
+				prefix_file_buf[lut_pos] = kept;
+			const uchar* record_ptr = part.data() + i * sufix_rec_size;
+			uint64 counter;
+			if (ReadCounter(record_ptr, counter))
+				memcpy(sufix_file_buf + kept++ * sufix_size, record_ptr, sufix_size);
+		}
+	}
+	for (; lut_pos < last_data_index; ++lut_pos)
+		prefix_file_buf[lut_pos] = kept;
+	prefix_file_buf[last_data_index] = kept + 1;	//as ReadParamsFrom_prefix_file_buf sets it
+
+	if (kept < total_kmers)
+	{
+		CArea compact_area;
+		uchar* compact = (uchar*)AllocateArea(kept * sufix_size + SUFIX_PADDING, compact_area);
+		if (!compact)
+			return false;
+		memcpy(compact, sufix_file_buf, kept * sufix_size);
+		FreeArea(sufix_area);
+		sufix_area = compact_area;
+		sufix_file_buf = compact;
+	}
+	else
+		memset(sufix_file_buf + kept * sufix_size, 0, SUFIX_PADDING);
+	total_kmers = kept;
+	counter_size = 0;
+	SetSufixSizes();
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Bit streams of layout_compressed. MSB first streams hold suffix bits in the order of
+// MakeSufixPattern; values are MSB aligned and at most 64 bits, and a stream has a word
+// of padding, so that 64 bits may be read from any position.
+//----------------------------------------------------------------------------------
+static inline void PutBitsMsb(uint64* stream, uint64 pos, uint64 value, uint32 bits)
+{
+	uint32 shift = pos & 63;
+	stream[pos >> 6] |= value >> shift;
+	if (shift && shift + bits > 64)
+		stream[(pos >> 6) + 1] |= value << (64 - shift);
+}
+
+static inline uint64 GetBitsMsb(const uint64* stream, uint64 pos)
+{
+	uint32 shift = pos & 63;
+	uint64 bits = stream[pos >> 6] << shift;
+	if (shift)
+		bits |= stream[(pos >> 6) + 1] >> (64 - shift);
+	return bits;
+}
+
+static inline void PutBitsLsb(uint64* stream, uint64 pos, uint64 value, uint32 bits)
+{
+	uint32 shift = pos & 63;
+	stream[pos >> 6] |= value << shift;
+	if (shift && shift + bits > 64)
+		stream[(pos >> 6) + 1] |= value >> (64 - shift);
+}
+
+static inline uint64 GetBitsLsb(const uint64* stream, uint64 pos, uint32 bits)
+{
+	uint32 shift = pos & 63;
+	uint64 value = stream[pos >> 6] >> shift;
+	if (shift && shift + bits > 64)
+		value |= stream[(pos >> 6) + 1] << (64 - shift);
+	return bits < 64 ? value & ((1ull << bits) - 1) : value;
+}
+
+// Position of the rank-th (from 0) set bit of a word that has more than rank of them,
+// narrowed down by halves
+static uint32 SelectInWordScalar(uint64 word, uint32 rank)
+{
+	uint32 pos = 0;
+	for (uint32 half = 32; half >= 8; half /= 2)
+	{
+		uint32 count = (uint32)my_popcount(word & ((1ull << half) - 1));
+		if (rank >= count)
+		{
+			rank -= count;
+			pos += half;
+			word >>= half;
+		}
+	}
+	for (; rank; --rank)
+		word &= word - 1;
+	return pos + (uint32)my_ctz(word);
+}
+
+#ifdef KMC_SCAN_X86
+__attribute__((target("bmi2"))) static uint32 SelectInWordBMI2(uint64 word, uint32 rank)
+{
+	return (uint32)my_ctz(_pdep_u64(1ull << rank, word));
+}
+#endif
+
+typedef uint32 (*select_in_word_t)(uint64 word, uint32 rank);
+
+// The select for this CPU, picked on first use
+static select_in_word_t SelectInWord()
+{
+	static const select_in_word_t select = [] {
+#ifdef KMC_SCAN_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("bmi2"))
+			return SelectInWordBMI2;
+#endif
+		return SelectInWordScalar;
+	}();
+	return select;
+}
+
+//----------------------------------------------------------------------------------
+// Read *.kmc_suf in parts of about 256 MB into the Elias-Fano coding of layout_compressed
+// (see CEliasFano), then free the LUT, which the keys and samples replace. low_bits is
+// about log2 of the key range per record, which takes some 2 bits of upper per record.
+// Counters are packed in as many bits as the largest possible one needs, then repacked
+// in as many as the largest one read needs; with load_presence_only they are dropped, as
+// are records counted below load_min_count.
+// RET	: true - if successful
+//----------------------------------------------------------------------------------
+bool CKMCFile::ReadEliasFanoSufixes()
+{
+	CEliasFano& ef = elias_fano;
+	const bool keep_counters = counter_size && !(sufix_load & load_presence_only);
+	if (!keep_counters && load_min_count > min_count && load_min_count <= max_count)
+		min_count = load_min_count;
+
+	const uint64 last_data_index = prefix_file_buf_size - 1;
+	const uint32 sufix_bits = sufix_size * 8;
+	ef.lut_bits = 0;
+	while (ef.lut_bits < 64 && ((last_data_index - 1) >> ef.lut_bits))
+		++ef.lut_bits;
+	const uint32 key_bits = ef.lut_bits + sufix_bits;
+	double range_bits = log2((double)std::max<uint64>(last_data_index, 1)) + sufix_bits - log2((double)std::max<uint64>(total_kmers, 1));
+	ef.low_bits = range_bits > 0 ? MIN((uint32)range_bits, key_bits) : 0;
+	ef.low_bits = std::max(ef.low_bits, key_bits > 63 ? key_bits - 63 : 0);
+	ef.high_bits = key_bits - ef.low_bits;
+	ef.low_words = (ef.low_bits + 63) / 64;
+	ef.low_last_mask = ef.low_bits % 64 ? ~0ull << (64 - ef.low_bits % 64) : ~0ull;
+	ef.counter_bits = 0;
+	if (keep_counters)
+	{
+		uint64 max_counter = MIN(max_count, counter_size >= 8 ? ~0ull : (1ull << (8 * counter_size)) - 1);
+		while (ef.counter_bits < 64 && (max_counter >> ef.counter_bits))
+			++ef.counter_bits;
+	}
+
+	uint64 pattern[MAX_SUFIX_WORDS], low[MAX_SUFIX_WORDS + 1];
+	uint64 high;
+	for (uint32 w = 0; w < sufix_words; ++w)
+		pattern[w] = w + 1 < sufix_words ? ~0ull : sufix_last_mask;
+	EliasFanoKey(last_data_index - 1, pattern, high, low);	//the largest key
+	ef.high_values = high + 1;
+	ef.upper_bits = total_kmers + ef.high_values;
+
+	uint64 samples_count = ef.high_values / ef_sample_step + 1;
+	uint64* upper = (uint64*)AllocateArea((ef.upper_bits / 64 + 2) * sizeof(uint64), ef.upper);
+	uint64* lower = (uint64*)AllocateArea((total_kmers * ef.low_bits / 64 + 2) * sizeof(uint64), ef.lower);
+	uint64* counters = (uint64*)AllocateArea((total_kmers * ef.counter_bits / 64 + 2) * sizeof(uint64), ef.counters);
+	uint64* samples = (uint64*)AllocateArea((samples_count + 1) * sizeof(uint64), ef.samples);
+	if (!upper || !lower || !counters || !samples)
+		return false;
+
+	uint64 part_records = std::max<uint64>(1, MIN((1ull << 28) / std::max<uint32>(sufix_rec_size, 1), total_kmers));
+	std::vector<uchar> part(part_records * sufix_rec_size + SUFIX_PADDING);
+	uint64 lut_pos = 0, kept = 0, next_sample = 0, max_read = 0;
+	for (uint64 record = 0; record < total_kmers;)
+	{
+		uint64 n = MIN(part_records, total_kmers - record);
+		if (!ReadParallel(file_suf, 4 + record * sufix_rec_size, part.data(), n * sufix_rec_size))
+			return false;
+		memset(part.data() + n * sufix_rec_size, 0, SUFIX_PADDING);
+		for (uint64 i = 0; i < n; ++i, ++record)
+		{
+			while (lut_pos < last_data_index && prefix_file_buf[lut_pos] <= record)
+				++lut_pos;
+			const uchar* record_ptr = part.data() + i * sufix_rec_size;
+			uint64 counter;
+			if (!ReadCounter(record_ptr, counter) && !keep_counters)
+				continue;
+			for (uint32 w = 0; w < sufix_words; ++w)
+				pattern[w] = LoadSufixWord(record_ptr + 8 * w);
+			if (sufix_words)
+				pattern[sufix_words - 1] &= sufix_last_mask;
+
+			EliasFanoKey(lut_pos - 1, pattern, high, low);	//the record is in bucket lut_pos - 1
+			//runs of high values up to this one start here
+			for (; next_sample * ef_sample_step <= high; ++next_sample)
+				samples[next_sample] = next_sample * ef_sample_step + kept;
+			uint64 bit = high + kept;
+			upper[bit >> 6] |= 1ull << (bit & 63);
+			for (uint32 w = 0; w < ef.low_words; ++w)
+				PutBitsMsb(lower, kept * ef.low_bits + 64 * w, low[w], w + 1 < ef.low_words ? 64 : ef.low_bits - 64 * w);
+			if (keep_counters)
+			{
+				PutBitsLsb(counters, kept * ef.counter_bits, counter, ef.counter_bits);
+				max_read = std::max(max_read, counter);
+			}
+			++kept;
+		}
+	}
+	for (; next_sample <= samples_count; ++next_sample)
+		samples[next_sample] = next_sample * ef_sample_step + kept;
+
+	uint32 read_bits = 1;
+	while (read_bits < 64 && (max_read >> read_bits))
+		++read_bits;
+	if (keep_counters && read_bits < ef.counter_bits)
+	{
+		CArea packed_area;
+		uint64* packed = (uint64*)AllocateArea((kept * read_bits / 64 + 2) * sizeof(uint64), packed_area);
+		if (!packed)
+			return false;
+		for (uint64 i = 0; i < kept; ++i)
+			PutBitsLsb(packed, i * read_bits, GetBitsLsb(counters, i * ef.counter_bits, ef.counter_bits), read_bits);
+		FreeArea(ef.counters);
+		ef.counters = packed_area;
+		ef.counter_bits = read_bits;
+	}
+
+	//records dropped by load_min_count leave their share of upper unused
+	ef.upper_bits = kept + ef.high_values;
+	total_kmers = kept;
+	if (!keep_counters)
+		counter_size = 0;
+	SetSufixSizes();
+	FreeArea(prefix_area);
+	prefix_file_buf = NULL;
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// The key of a record of layout_compressed: lut_bits bits of the bucket followed by the
+// suffix, split after its high_bits leading bits.
+// OUT	: high	- the leading bits
+// OUT	: low	- the remaining ones, low_words words, the last masked with low_last_mask
+//----------------------------------------------------------------------------------
+void CKMCFile::EliasFanoKey(uint64 lut_pos, const uint64* pattern, uint64 &high, uint64* low) const
+{
+	const CEliasFano& ef = elias_fano;
+	const uint32 s = ef.lut_bits, h = ef.high_bits;
+	uint64 key[MAX_SUFIX_WORDS + 2];
+	key[0] = (s ? lut_pos << (64 - s) : 0) | (sufix_words ? pattern[0] >> s : 0);
+	for (uint32 w = 1; w <= sufix_words; ++w)
+		key[w] = (s ? pattern[w - 1] << (64 - s) : 0) | (w < sufix_words ? pattern[w] >> s : 0);
+	key[sufix_words + 1] = 0;
+
+	high = h ? key[0] >> (64 - h) : 0;
+	for (uint32 w = 0; w < ef.low_words; ++w)
+		low[w] = (key[w] << h) | (h ? key[w + 1] >> (64 - h) : 0);
+	if (ef.low_words)
+		low[ef.low_words - 1] &= ef.low_last_mask;
+}
+
+int CKMCFile::CompareEliasFanoLow(uint64 index, const uint64* low) const
+{
+	const CEliasFano& ef = elias_fano;
+	const uint64* lower = (const uint64*)ef.lower.base;
+	for (uint32 w = 0; w < ef.low_words; ++w)
+	{
+		uint64 word = GetBitsMsb(lower, index * ef.low_bits + 64 * w);
+		if (w + 1 == ef.low_words)
+			word &= ef.low_last_mask;
+		if (word != low[w])
+			return word < low[w] ? -1 : 1;
+	}
+	return 0;
+}
+
+bool CKMCFile::ReadEliasFanoCounter(uint64 index, uint64 &counter) const
+{
+	const CEliasFano& ef = elias_fano;
+	if (ef.counter_bits == 0)
+	{
+		counter = 1;
+		return true;
+	}
+	counter = GetBitsLsb((const uint64*)ef.counters.base, index * ef.counter_bits, ef.counter_bits);
+	return (counter >= min_count) && (counter <= max_count);
+}
+
+bool CKMCFile::EliasFanoSearch(uint64 lut_pos, const uint64* pattern, uint64& counter) const
+{
+	uint64 high, low[MAX_SUFIX_WORDS + 1];
+	EliasFanoKey(lut_pos, pattern, high, low);
+	return EliasFanoFind(high, low, counter);
+}
+
+//----------------------------------------------------------------------------------
+// Prefetch where the records of a high value likely are, as many per high value past the
+// sample below it as the samples around it give (canonical kmers are far from uniform),
+// and the upper word where its select likely ends, so that upper, the low bits and the
+// counters load together instead of one after another.
+//----------------------------------------------------------------------------------
+void CKMCFile::PrefetchEliasFano(uint64 high) const
+{
+	const CEliasFano& ef = elias_fano;
+	const uint64* samples = (const uint64*)ef.samples.base + high / ef_sample_step;
+	uint64 skip = high % ef_sample_step;
+	uint64 guess = samples[0] - (high - skip) + skip * (samples[1] - samples[0] - ef_sample_step) / ef_sample_step;
+	my_prefetch((const uchar*)ef.upper.base + ((high + guess) >> 3));
+	my_prefetch((const uchar*)ef.lower.base + (guess * ef.low_bits >> 3));
+	my_prefetch((const uchar*)ef.counters.base + (guess * ef.counter_bits >> 3));
+}
+
+//----------------------------------------------------------------------------------
+// Search layout_compressed for a key. Select starts at the sample below its high value and
+// skips fewer than ef_sample_step zeros from there (a few words) to reach the run of
+// records sharing its high bits, whose low bits are then compared, scanning short runs and
+// bisecting long ones.
+// IN	: high, low	- the key, see EliasFanoKey
+// OUT	: counter	- kmer's counter if kmer exists
+//----------------------------------------------------------------------------------
+bool CKMCFile::EliasFanoFind(uint64 high, const uint64* low, uint64& counter) const
+{
+	const CEliasFano& ef = elias_fano;
+	const uint64* upper = (const uint64*)ef.upper.base;
+
+	//select: the position after the high-th zero
+	uint64 pos = ((const uint64*)ef.samples.base)[high / ef_sample_step];
+	uint64 skip = high % ef_sample_step;
+	if (skip)
+	{
+		uint64 word = pos >> 6;
+		uint64 zeros = ~upper[word] & (~0ull << (pos & 63));
+		for (uint64 count; (count = my_popcount(zeros)) < skip; zeros = ~upper[++word])
+			skip -= count;
+		pos = word * 64 + SelectInWord()(zeros, (uint32)skip - 1) + 1;
+	}
+	//the run of ones from there
+	uint64 lo = pos - high, hi = lo;
+	for (;;)
+	{
+		uint32 offset = pos & 63;
+		uint64 rest = ~(upper[pos >> 6] >> offset);
+		uint32 ones = MIN(rest ? (uint32)my_ctz(rest) : 64u, 64 - offset);
+		hi += ones;
+		pos += ones;
+		if (offset + ones < 64)
+			break;
+	}
+
+	while (hi - lo > scan_threshold)
+	{
+		uint64 mid = (lo + hi) / 2;
+		int cmp = CompareEliasFanoLow(mid, low);
+		if (cmp == 0)
+			return ReadEliasFanoCounter(mid, counter);
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < hi; ++lo)
+	{
+		int cmp = CompareEliasFanoLow(lo, low);
+		if (cmp == 0)
+			return ReadEliasFanoCounter(lo, counter);
+		if (cmp > 0)
+			break;
+	}
+	return false;
+}
+
+//----------------------------------------------------------------------------------
+// Look up the entries of a batch left by CheckKmers one by one. The keys of the next
+// 2 * lookup_lanes entries are kept in a ring; the samples of an entry are prefetched
+// 2 * lookup_lanes entries ahead, and its likely records (see PrefetchEliasFano)
+// lookup_lanes entries ahead.
+// RET	: the number of kmers that exist
+//----------------------------------------------------------------------------------
+uint64 CKMCFile::CheckEliasFanoKmers(CKmerBatch &batch, uint32 no_of_rows, uchar byte_alignment)
+{
+	const CEliasFano& ef = elias_fano;
+	const uint64* samples = (const uint64*)ef.samples.base;
+	const uint64 entries = batch.entries.size();
+	const uint32 ring = 2 * lookup_lanes;
+	uint64 highs[ring], lows[ring][MAX_SUFIX_WORDS + 1];
+	uint64 pattern[MAX_SUFIX_WORDS];
+	auto add_key = [&](uint64 j) {
+		const CKmerBatch::CEntry& entry = batch.entries[j];
+		MakeSufixPattern(&batch.aligned[entry.index * no_of_rows], byte_alignment, pattern);
+		EliasFanoKey(entry.lut_pos, pattern, highs[j % ring], lows[j % ring]);
+		my_prefetch(&samples[highs[j % ring] / ef_sample_step]);
+	};
+	for (uint64 j = 0; j < MIN((uint64)ring, entries); ++j)
+		add_key(j);
+
+	uint64 found = 0;
+	for (uint64 j = 0; j < entries; ++j)
+	{
+		if (j + lookup_lanes < entries)
+			PrefetchEliasFano(highs[(j + lookup_lanes) % ring]);
+		uint64 counter;
+		if (EliasFanoFind(highs[j % ring], lows[j % ring], counter))
+		{
+			batch.counters[batch.entries[j].index] = counter;
+			++found;
+		}
+		if (j + ring < entries)
+			add_key(j + ring);
+	}
+	return found;
+}
+
+//----------------------------------------------------------------------------------
+// Decode the records of layout_compressed in order from a sample on, walking upper: a
+// one is the next record, a zero the end of the current high value.
+//----------------------------------------------------------------------------------
+template<typename F> void CKMCFile::ForEachEliasFanoRecord(uint64 first_sample, uint64 last_sample, F&& visit) const
+{
+	const CEliasFano& ef = elias_fano;
+	const uint64* upper = (const uint64*)ef.upper.base;
+	const uint64* lower = (const uint64*)ef.lower.base;
+	const uint32 s = ef.lut_bits, h = ef.high_bits;
+	uint64 high = first_sample * ef_sample_step;
+	uint64 stop = MIN(last_sample * ef_sample_step, ef.high_values);
+	uint64 pos = ((const uint64*)ef.samples.base)[first_sample];
+	uint64 index = pos - high;
+	uint64 key[MAX_SUFIX_WORDS + 2], low[MAX_SUFIX_WORDS + 2] = {}, pattern[MAX_SUFIX_WORDS];
+	for (; high < stop; ++pos)
+	{
+		if (!((upper[pos >> 6] >> (pos & 63)) & 1))
+		{
+			++high;
+			continue;
+		}
+		for (uint32 w = 0; w < ef.low_words; ++w)
+			low[w] = GetBitsMsb(lower, index * ef.low_bits + 64 * w);
+		if (ef.low_words)
+			low[ef.low_words - 1] &= ef.low_last_mask;
+		//the key is the high bits followed by the low ones, then the bucket and the suffix
+		for (uint32 w = 0; w <= sufix_words; ++w)
+			key[w] = h ? (w ? low[w - 1] << (64 - h) : high << (64 - h)) | (low[w] >> h) : low[w];
+		key[sufix_words + 1] = 0;
+		uint64 lut_pos = s ? key[0] >> (64 - s) : 0;
+		for (uint32 w = 0; w < sufix_words; ++w)
+			pattern[w] = (key[w] << s) | (s ? key[w + 1] >> (64 - s) : 0);
+		if (sufix_words)
+			pattern[sufix_words - 1] &= sufix_last_mask;
+		visit(lut_pos, (const uint64*)pattern);
+		++index;
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Map *.kmc_suf instead of reading it. The whole file is mapped (mmap offsets must be
+// page aligned) over zero pages reserved for SUFIX_PADDING, and sufix_file_buf starts
+// after the initial marker. Auxiliary function.
+// IN	: size		- the size of the file without initial and terminal markers
+// IN	: writable	- map copy-on-write pages that may be modified
+// RET	: true		- if successful; the file is left for reading otherwise
+//----------------------------------------------------------------------------------
+bool CKMCFile::MapSufixFile(uint64 size, bool writable)
+{
+#ifndef _WIN32
+	uint64 page = sysconf(_SC_PAGESIZE);
+	uint64 file_size = size + 8;
+	uint64 map_size = (4 + size + SUFIX_PADDING + page - 1) / page * page;
+	int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+
+	void* area = mmap(nullptr, map_size, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		return false;
+	int flags = MAP_PRIVATE | MAP_FIXED;
+#ifdef MAP_POPULATE
+	if (sufix_load & load_populate)
+		flags |= MAP_POPULATE;
+#endif
+	if (mmap(area, file_size, prot, flags, fileno(file_suf), 0) == MAP_FAILED)
+	{
+		munmap(area, map_size);
+		return false;
+	}
+	if (sufix_load & load_random)
+		madvise(area, map_size, MADV_RANDOM);
+#ifdef MADV_HUGEPAGE
+	if (sufix_load & load_hugepage)
+		madvise(area, map_size, MADV_HUGEPAGE);
+#endif
+
+	sufix_map = (uchar*)area;
+	sufix_map_size = map_size;
+	sufix_file_buf = sufix_map + 4;
+	return true;
+#else
+	return false;
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Free sufix_file_buf, or unmap it if it was mapped. Auxiliary function.
+//----------------------------------------------------------------------------------
+void CKMCFile::ReleaseSufixBuffer()
+{
+#ifndef _WIN32
+	if (sufix_map)
+	{
+		munmap(sufix_map, sufix_map_size);
+		sufix_map = nullptr;
+		sufix_file_buf = NULL;
+		return;
+	}
+#endif
+	FreeArea(elias_fano.upper);
+	FreeArea(elias_fano.lower);
+	FreeArea(elias_fano.counters);
+	FreeArea(elias_fano.samples);
+	elias_fano = CEliasFano();
+	if (sufix_area.base)
+		FreeArea(sufix_area);
+	else
+		delete[] sufix_file_buf;	//the listing buffer
+	sufix_file_buf = NULL;
+}
+
+//----------------------------------------------------------------------------------
+// Map an anonymous area for a buffer read in random access mode. With huge_explicit_*
+// a buffer of at least one such page comes from the hugetlbfs pool if it has enough pages
+// reserved; what it could not hold is counted in huge_pool_missed. Otherwise the area is
+// 2 MB aligned and rounded, so that every part of it may be a transparent huge page, and
+// advised so with huge_transparent (or with explicit pages missing or too large). The
+// pages are zero. Auxiliary function.
+// IN	: size	- bytes of the buffer
+// OUT	: area	- the mapping, for FreeArea
+// RET	: the buffer, nullptr if out of memory
+//----------------------------------------------------------------------------------
+void* CKMCFile::AllocateArea(uint64 size, CArea& area)
+{
+#ifndef _WIN32
+	const uint64 huge_page = 1ull << 21;
+	size = std::max<uint64>(size, 1);
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+	//only buffers of a page or more, so that small ones do not take pool pages the suffix records need
+	uint32 page_shift = huge_mode == huge_explicit_1g ? 30 : 21;
+	if ((huge_mode == huge_explicit_2m || huge_mode == huge_explicit_1g) && size >= (1ull << page_shift))
+	{
+		uint64 map_size = AlignUp(size, 1ull << page_shift);
+		void* base = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT), -1, 0);
+		if (base != MAP_FAILED)
+		{
+			area.base = base;
+			area.size = map_size;
+			return base;
+		}
+		huge_pool_missed += size;
+	}
+#endif
+	//reserve an alignment more, then trim the mapping to aligned bounds; small buffers stay on normal pages
+	uint64 alignment = size >= huge_page ? huge_page : sysconf(_SC_PAGESIZE);
+	uint64 map_size = AlignUp(size, alignment);
+	uchar* reserved = (uchar*)mmap(nullptr, map_size + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (reserved == MAP_FAILED)
+		return nullptr;
+	uchar* base = (uchar*)AlignUp((uint64)reserved, alignment);
+	if (base > reserved)
+		munmap(reserved, base - reserved);
+	if (reserved + alignment > base)
+		munmap(base + map_size, reserved + alignment - base);
+#ifdef MADV_HUGEPAGE
+	if (huge_mode != huge_none && alignment == huge_page)
+		madvise(base, map_size, MADV_HUGEPAGE);
+#endif
+	area.base = base;
+	area.size = map_size;
+	return base;
+#else
+	area.base = new uchar[size]();
+	area.size = size;
+	return area.base;
+#endif
+}
+
+void CKMCFile::FreeArea(CArea& area)
+{
+	if (!area.base)
+		return;
+#ifndef _WIN32
+	munmap(area.base, area.size);
+#else
+	delete[] (uchar*)area.base;
+#endif
+	area = CArea();
+}
+
+//----------------------------------------------------------------------------------
+// Sizes of suffix records. Auxiliary function.
+//----------------------------------------------------------------------------------
+void CKMCFile::SetSufixSizes()
+{
+	sufix_size = (kmer_length - lut_prefix_length) / 4;
+	sufix_rec_size = sufix_size + counter_size;
+	sufix_words = (sufix_size + 7) / 8;
+	sufix_last_mask = ~0ull << ((sufix_words * 8 - sufix_size) * 8);
+}
+
 //----------------------------------------------------------------------------------	
 // Open a file, recognize its size and check its marker. Auxiliary function.
 // IN	: file_name - the name of a file to open
@@ -225,24 +954,23 @@ bool CKMCFile::ReadParamsFrom_prefix_file_buf(uint64 &size, open_mode _open_mode
 
 		fseek(file_pre, 4 + lut_area_size_in_bytes + 8, SEEK_SET);
 		result = fread(signature_map, 1, signature_map_size * sizeof(uint32), file_pre);
-		if (result == 0)
+		if (result != signature_map_size * sizeof(uint32))
 			return false;
 
 		if(_open_mode == opened_for_RA)
 		{
-			rewind(file_pre);
-			my_fseek(file_pre, +4, SEEK_CUR);
 			prefix_file_buf_size = (lut_area_size_in_bytes + 8) / sizeof(uint64);		//reads without 4 bytes of a header_offset (and without markers)
-			prefix_file_buf = new uint64[prefix_file_buf_size];
-			result = fread(prefix_file_buf, 1, (size_t)(lut_area_size_in_bytes + 8), file_pre);
-			if (result == 0)
+			prefix_file_buf = (uint64*)AllocateArea(prefix_file_buf_size * sizeof(uint64), prefix_area);
+			if (!prefix_file_buf)
+				return false;
+			if (!ReadParallel(file_pre, 4, prefix_file_buf, lut_area_size_in_bytes + 8))
+			{
+				std::cerr << "Error: some error while reading prefix file\n";
 				return false;
+			}
 
 			prefix_file_buf[last_data_index] = total_kmers + 1; //I think + 1 if wrong, but due to the implementation of binary search it does not matter, it was here in kmc 0.3 and I leave it this way just in case...
-
-			result = fread(signature_map, 1, signature_map_size * sizeof(uint32), file_pre);
-			if (result == 0)
-				return false;
+			//signature_map, which follows the LUT, has been read above
 
 			fclose(file_pre);
 			file_pre = nullptr;
@@ -252,9 +980,7 @@ bool CKMCFile::ReadParamsFrom_prefix_file_buf(uint64 &size, open_mode _open_mode
 			prefixFileBufferForListingMode = std::make_unique<CPrefixFileBufferForListingMode>(file_pre, last_data_index, lut_prefix_length, false, total_kmers);
 		}
 
-		sufix_size = (kmer_length - lut_prefix_length) / 4;
-	
-		sufix_rec_size = sufix_size + counter_size;	
+		SetSufixSizes();
 
 		return true;
 	}
@@ -298,11 +1024,14 @@ bool CKMCFile::ReadParamsFrom_prefix_file_buf(uint64 &size, open_mode _open_mode
 
 		if (_open_mode == opened_for_RA)
 		{
-			prefix_file_buf = new uint64[prefix_file_buf_size];
-			fseek(file_pre, 4, SEEK_SET);
-			result = fread(prefix_file_buf, 1, (size_t)(prefix_file_buf_size * sizeof(uint64)), file_pre);
-			if (result == 0)
+			prefix_file_buf = (uint64*)AllocateArea(prefix_file_buf_size * sizeof(uint64), prefix_area);
+			if (!prefix_file_buf)
 				return false;
+			if (!ReadParallel(file_pre, 4, prefix_file_buf, prefix_file_buf_size * sizeof(uint64)))
+			{
+				std::cerr << "Error: some error while reading prefix file\n";
+				return false;
+			}
 
 			prefix_file_buf[last_data_index] = total_kmers + 1; //I think + 1 if wrong, but due to the implementation of binary search it does not matter, it was here in kmc 0.3 and I leave it this way just in case...
 
@@ -314,9 +1043,7 @@ bool CKMCFile::ReadParamsFrom_prefix_file_buf(uint64 &size, open_mode _open_mode
 			prefixFileBufferForListingMode = std::make_unique<CPrefixFileBufferForListingMode>(file_pre, last_data_index, lut_prefix_length, true, total_kmers);
 		}
 
-		sufix_size = (kmer_length - lut_prefix_length) / 4;
-
-		sufix_rec_size = sufix_size + counter_size;
+		SetSufixSizes();
 
 		return true;
 
@@ -332,38 +1059,8 @@ bool CKMCFile::ReadParamsFrom_prefix_file_buf(uint64 &size, open_mode _open_mode
 //------------------------------------------------------------------------------------------
 bool CKMCFile::CheckKmer(CKmerAPI &kmer, uint32 &count)
 {
-	if(is_opened != opened_for_RA)
-		return false;
-	if(end_of_file)
-		return false;
-	
-	//recognize a prefix:
-	uint64 pattern_prefix_value = kmer.kmer_data[0];
-
-	uint32 pattern_offset = (sizeof(pattern_prefix_value)* 8) - (lut_prefix_length * 2) - (kmer.byte_alignment * 2);
-	int64 index_start = 0, index_stop = 0;
-
-	pattern_prefix_value = pattern_prefix_value >> pattern_offset;  //complements with 0
-	if (pattern_prefix_value >= prefix_file_buf_size)
-		return false;
-
-	if (kmc_version == 0x200)
-	{
-		uint32 signature = kmer.get_signature(signature_len);
-		uint32 bin_start_pos = signature_map[signature];
-		bin_start_pos *= single_LUT_size;				
-		//look into the array with data
-		index_start = *(prefix_file_buf + bin_start_pos + pattern_prefix_value);
-		index_stop = *(prefix_file_buf + bin_start_pos + pattern_prefix_value + 1) - 1;
-	}
-	else if (kmc_version == 0)
-	{
-		//look into the array with data
-		index_start = prefix_file_buf[pattern_prefix_value];
-		index_stop = prefix_file_buf[pattern_prefix_value + 1] - 1;
-	}
-	uint64 tmp_count ;
-	bool res = BinarySearch(index_start, index_stop, kmer, tmp_count, pattern_offset);
+	uint64 tmp_count;
+	bool res = CheckAlignedKmer<0>(kmer.kmer_data, kmer.byte_alignment, tmp_count);
 	count = (uint32)tmp_count;
 	return res;
 }
@@ -376,37 +1073,40 @@ bool CKMCFile::CheckKmer(CKmerAPI &kmer, uint32 &count)
 //------------------------------------------------------------------------------------------
 bool CKMCFile::CheckKmer(CKmerAPI &kmer, uint64 &count)
 {
-	if (is_opened != opened_for_RA)
-		return false;
-	if (end_of_file)
-		return false;
-
-	//recognize a prefix:
-	uint64 pattern_prefix_value = kmer.kmer_data[0];
+	return CheckAlignedKmer<0>(kmer.kmer_data, kmer.byte_alignment, count);
+}
 
-	uint32 pattern_offset = (sizeof(pattern_prefix_value)* 8) - (lut_prefix_length * 2) - (kmer.byte_alignment * 2);
-	int64 index_start = 0, index_stop = 0;
+//------------------------------------------------------------------------------------------
+// Check if kmer exists. 
+// IN : kmer  - kmer as packed words in the CKmerAPI::to_long layout, ceil(kmer_length / 32) words
+// OUT: count - kmer's counter if kmer exists
+// RET: true  - if kmer exists
+//------------------------------------------------------------------------------------------
+bool CKMCFile::CheckKmer(const uint64* kmer, uint32 &count)
+{
+	uint64 tmp_count;
+	bool res = CheckKmer<0>(kmer, tmp_count);
+	count = (uint32)tmp_count;
+	return res;
+}
 
-	pattern_prefix_value = pattern_prefix_value >> pattern_offset;  //complements with 0
-	if (pattern_prefix_value >= prefix_file_buf_size)
-		return false;
+//------------------------------------------------------------------------------------------
+// Check if kmer exists. 
+// IN : kmer  - kmer
+// OUT: count - kmer's counter if kmer exists
+// RET: true  - if kmer exists
+//------------------------------------------------------------------------------------------
+bool CKMCFile::CheckKmer(const CKmerValue &kmer, uint32 &count)
+{
+	uint64 tmp_count;
+	bool res = CheckAlignedKmer<0>(kmer.kmer_data, kmer.byte_alignment, tmp_count);
+	count = (uint32)tmp_count;
+	return res;
+}
 
-	if (kmc_version == 0x200)
-	{
-		uint32 signature = kmer.get_signature(signature_len);
-		uint32 bin_start_pos = signature_map[signature];
-		bin_start_pos *= single_LUT_size;
-		//look into the array with data
-		index_start = *(prefix_file_buf + bin_start_pos + pattern_prefix_value);
-		index_stop = *(prefix_file_buf + bin_start_pos + pattern_prefix_value + 1) - 1;
-	}
-	else if (kmc_version == 0)
-	{
-		//look into the array with data
-		index_start = prefix_file_buf[pattern_prefix_value];
-		index_stop = prefix_file_buf[pattern_prefix_value + 1] - 1;
-	}
-	return BinarySearch(index_start, index_stop, kmer, count, pattern_offset);
+bool CKMCFile::CheckKmer(const CKmerValue &kmer, uint64 &count)
+{
+	return CheckAlignedKmer<0>(kmer.kmer_data, kmer.byte_alignment, count);
 }
 
 //-----------------------------------------------------------------------------------------------
@@ -419,92 +1119,12 @@ bool CKMCFile::Eof(void)
 }
 
 //-----------------------------------------------------------------------------------------------
-// Read next kmer
+// Read next kmer. KMER is CKmerAPI or CKmerValue, COUNT is uint32 or uint64
 // OUT: kmer - next kmer
 // OUT: count - kmer's counter
 // RET: true - if not EOF
 //-----------------------------------------------------------------------------------------------
-bool CKMCFile::ReadNextKmer(CKmerAPI &kmer, uint32 &count)
-{
-	if(is_opened != opened_for_listing)
-		return false;
-	do
-	{
-		if(end_of_file)
-			return false;
-	
-		uint32 off = (sizeof(prefix_index) * 8) - (lut_prefix_length * 2) - kmer.byte_alignment * 2;
-		uint64 prefix = prefixFileBufferForListingMode->GetPrefix(sufix_number);
-
-		uint64 temp_prefix = prefix << off;	// shift prefix towards MSD. "& prefix_mask" necessary for kmc2 db format
-		
-		kmer.kmer_data[0] = temp_prefix;			// store prefix in an object CKmerAPI
-
-		for(uint32 i = 1; i < kmer.no_of_rows; i++)
-			kmer.kmer_data[i] = 0;
-
-		//read sufix:
-		uint32 row_index = 0;
- 		uint64 suf = 0;
-	
-		off = off - 8;
-				
- 		for(uint32 a = 0; a < sufix_size; a ++)
-		{
-			if(index_in_partial_buf == part_size)
-				Reload_sufix_file_buf();
-						
-			suf = sufix_file_buf[index_in_partial_buf++];
-			suf = suf << off;
-			kmer.kmer_data[row_index] = kmer.kmer_data[row_index] | suf;
-
-			if (off == 0)				//the end of a word in kmer_data
-			{
-					off = 56;
-					row_index++;
-			}
-			else
-					off -=8;
-		}
-		
-		//read counter:
-		if (counter_size == 0)
-			count = 1;
-		else
-		{
-			
-			if (index_in_partial_buf == part_size)
-				Reload_sufix_file_buf();
-
-			count = sufix_file_buf[index_in_partial_buf++];
-
-			for (uint32 b = 1; b < counter_size; b++)
-			{
-				if (index_in_partial_buf == part_size)
-					Reload_sufix_file_buf();
-
-				uint32 aux = 0x000000ff & sufix_file_buf[index_in_partial_buf++];
-				aux = aux << 8 * (b);
-				count = aux | count;
-			}
-		}
-		sufix_number++;
-	
-		if(sufix_number == total_kmers)
-			end_of_file = true;
-	}
-	while ((counter_size != 0) && ((count < min_count) || (count > max_count))); //do not applay filtering if counter_size == 0 as it does not make sense
-
-	return true;
-}
-
-//-----------------------------------------------------------------------------------------------
-// Read next kmer
-// OUT: kmer - next kmer
-// OUT: count - kmer's counter
-// RET: true - if not EOF
-//-----------------------------------------------------------------------------------------------
-bool CKMCFile::ReadNextKmer(CKmerAPI &kmer, uint64 &count)
+template<typename KMER, typename COUNT> bool CKMCFile::ReadNextKmerImpl(KMER &kmer, COUNT &count)
 {
 	if (is_opened != opened_for_listing)
 		return false;
@@ -562,7 +1182,7 @@ bool CKMCFile::ReadNextKmer(CKmerAPI &kmer, uint64 &count)
 				if (index_in_partial_buf == part_size)
 					Reload_sufix_file_buf();
 
-				uint64 aux = 0x000000ff & sufix_file_buf[index_in_partial_buf++];
+				COUNT aux = 0x000000ff & sufix_file_buf[index_in_partial_buf++];
 				aux = aux << 8 * (b);
 				count = aux | count;
 			}
@@ -574,7 +1194,51 @@ bool CKMCFile::ReadNextKmer(CKmerAPI &kmer, uint64 &count)
 
 	} while ((counter_size != 0) && ((count < min_count) || (count > max_count))); //do not applay filtering if counter_size == 0 as it does not make sense
 
-	return true;
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------------
+// Read next kmer
+// OUT: kmer - next kmer
+// OUT: count - kmer's counter
+// RET: true - if not EOF
+//-----------------------------------------------------------------------------------------------
+bool CKMCFile::ReadNextKmer(CKmerAPI &kmer, uint32 &count)
+{
+	return ReadNextKmerImpl(kmer, count);
+}
+
+//-----------------------------------------------------------------------------------------------
+// Read next kmer
+// OUT: kmer - next kmer
+// OUT: count - kmer's counter
+// RET: true - if not EOF
+//-----------------------------------------------------------------------------------------------
+bool CKMCFile::ReadNextKmer(CKmerAPI &kmer, uint64 &count)
+{
+	return ReadNextKmerImpl(kmer, count);
+}
+
+//-----------------------------------------------------------------------------------------------
+// Read next kmer
+// OUT: kmer - next kmer
+// OUT: count - kmer's counter
+// RET: true - if not EOF
+//-----------------------------------------------------------------------------------------------
+bool CKMCFile::ReadNextKmer(CKmerValue &kmer, uint32 &count)
+{
+	return ReadNextKmerImpl(kmer, count);
+}
+
+//-----------------------------------------------------------------------------------------------
+// Read next kmer
+// OUT: kmer - next kmer
+// OUT: count - kmer's counter
+// RET: true - if not EOF
+//-----------------------------------------------------------------------------------------------
+bool CKMCFile::ReadNextKmer(CKmerValue &kmer, uint64 &count)
+{
+	return ReadNextKmerImpl(kmer, count);
 }
 
 //-------------------------------------------------------------------------------
@@ -601,31 +1265,41 @@ bool CKMCFile::Close()
 {
 	if(is_opened)
 	{
-		if(file_pre)
-		{
-			fclose(file_pre);	
-			file_pre = NULL;
-		}
-		if(file_suf)
-		{
-			fclose(file_suf);
-			file_suf = NULL;
-		}
-	
-		is_opened = closed;
-		end_of_file = false;
-		delete [] prefix_file_buf;
-		prefix_file_buf = NULL;
-		delete [] sufix_file_buf;
-		sufix_file_buf = NULL;
-		delete[] signature_map;
-		signature_map = NULL;
-
+		ReleaseAll();
 		return true;
 	}
 	else
 		return false;
 }
+//-------------------------------------------------------------------------------
+// Close the files and release every buffer, whether or not an open has completed.
+// Auxiliary function.
+//-------------------------------------------------------------------------------
+void CKMCFile::ReleaseAll()
+{
+	if(file_pre)
+	{
+		fclose(file_pre);	
+		file_pre = NULL;
+	}
+	if(file_suf)
+	{
+		fclose(file_suf);
+		file_suf = NULL;
+	}
+
+	is_opened = closed;
+	end_of_file = false;
+	sufix_loaded = loaded_none;
+	huge_pool_missed = 0;
+	ReleaseSharedSegment();
+	FreeArea(prefix_area);
+	prefix_file_buf = NULL;
+	ReleaseSufixBuffer();
+	delete[] signature_map;
+	signature_map = NULL;
+	ReleaseFilter();
+}
 //----------------------------------------------------------------------------------
 // Set initial values to enable listing kmers from the begining. Only in listing mode
 // RET: true - if a file has been opened for listing
@@ -645,6 +1319,7 @@ bool CKMCFile::RestartListing(void)
 		}
 
 		suf_file_left_to_read -= readed;
+		prefixFileBufferForListingMode->Restart();
 		prefix_index = 0;
 		sufix_number = 0;
 		index_in_partial_buf = 0;
@@ -750,6 +1425,12 @@ bool CKMCFile::IsKmer(CKmerAPI &kmer)
 		return false;
 }
 
+bool CKMCFile::IsKmer(const CKmerValue &kmer)
+{
+	uint64 _count;
+	return CheckKmer(kmer, _count);
+}
+
 //-----------------------------------------------------------------------------------------
 // Check the total number of kmers between current min_count and max_count
 // RET	: total number of kmers or 0 if a database has not been opened
@@ -764,7 +1445,13 @@ uint64 CKMCFile::KmerCount(void)
 			uint32 count;
 			uint64 aux_kmerCount = 0;
 
-			if(is_opened == opened_for_RA)
+			if (is_opened == opened_for_RA && sufix_layout == layout_compressed)
+			{
+				uint64 counter;
+				for (uint64 i = 0; i < total_kmers; i++)
+					aux_kmerCount += ReadEliasFanoCounter(i, counter);
+			}
+			else if(is_opened == opened_for_RA)
 			{
 				uchar *ptr = sufix_file_buf;
 				
@@ -913,15 +1600,32 @@ uint32 CKMCFile::count_for_kmer_kmc1(CKmerAPI& kmer)
 	pattern_prefix_value = pattern_prefix_value >> pattern_offset;  //complements with 0
 	if (pattern_prefix_value >= prefix_file_buf_size)
 		return false;
-	//look into the array with data
-
-	int64 index_start = prefix_file_buf[pattern_prefix_value];
-	int64 index_stop = prefix_file_buf[pattern_prefix_value + 1] - 1;
+	uint64 lut_pos = pattern_prefix_value;
+	if (filter && !FilterAdmits(lut_pos, kmer.kmer_data, kmer.byte_alignment))
+		return 0;
 
+	//look into the array with data
 	uint64 counter = 0;
-	if (BinarySearch(index_start, index_stop, kmer, counter, pattern_offset))
-		return (uint32)counter;
-	return 0;
+	bool found;
+	if (sufix_layout == layout_compressed)
+	{
+		uint64 pattern[MAX_SUFIX_WORDS];
+		MakeSufixPattern(kmer.kmer_data, kmer.byte_alignment, pattern);
+		found = EliasFanoSearch(lut_pos, pattern, counter);
+	}
+	else
+	{
+		int64 index_start = prefix_file_buf[lut_pos];
+		int64 index_stop = prefix_file_buf[lut_pos + 1] - 1;
+		found = BinarySearch(index_start, index_stop, kmer.kmer_data, kmer.byte_alignment, counter);
+	}
+	if (!found)
+	{
+		if (filter)
+			filter_absent.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+	return (uint32)counter;
 }
 
 //---------------------------------------------------------------------------------
@@ -937,15 +1641,32 @@ uint32 CKMCFile::count_for_kmer_kmc2(CKmerAPI& kmer, uint32 bin_start_pos)
 	pattern_prefix_value = pattern_prefix_value >> pattern_offset;  //complements with 0
 	if (pattern_prefix_value >= prefix_file_buf_size)
 		return false;
-	//look into the array with data
-
-	int64 index_start = *(prefix_file_buf + bin_start_pos + pattern_prefix_value);
-	int64 index_stop = *(prefix_file_buf + bin_start_pos + pattern_prefix_value + 1) - 1;
+	uint64 lut_pos = bin_start_pos + pattern_prefix_value;
+	if (filter && !FilterAdmits(lut_pos, kmer.kmer_data, kmer.byte_alignment))
+		return 0;
 
+	//look into the array with data
 	uint64 counter = 0;
-	if (BinarySearch(index_start, index_stop, kmer, counter, pattern_offset))
-		return (uint32)counter;
-	return 0;
+	bool found;
+	if (sufix_layout == layout_compressed)
+	{
+		uint64 pattern[MAX_SUFIX_WORDS];
+		MakeSufixPattern(kmer.kmer_data, kmer.byte_alignment, pattern);
+		found = EliasFanoSearch(lut_pos, pattern, counter);
+	}
+	else
+	{
+		int64 index_start = prefix_file_buf[lut_pos];
+		int64 index_stop = prefix_file_buf[lut_pos + 1] - 1;
+		found = BinarySearch(index_start, index_stop, kmer.kmer_data, kmer.byte_alignment, counter);
+	}
+	if (!found)
+	{
+		if (filter)
+			filter_absent.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+	return (uint32)counter;
 }
 
 //---------------------------------------------------------------------------------
@@ -1318,84 +2039,682 @@ bool CKMCFile::GetCountersForRead_kmc2(const std::string& read, std::vector<uint
 //---------------------------------------------------------------------------------
 // Auxiliary function.
 //---------------------------------------------------------------------------------
-bool CKMCFile::BinarySearch(int64 index_start, int64 index_stop, const CKmerAPI& kmer, uint64& counter, uint32 pattern_offset)
+bool CKMCFile::BinarySearch(int64 index_start, int64 index_stop, const uint64* kmer_data, uchar byte_alignment, uint64& counter)
 {
 	if (index_start >= static_cast<int64>(total_kmers))
 		return false;
-	uchar *sufix_byte_ptr = nullptr;
-	uint64 sufix = 0;
-
-	//sufix_offset is always 56
-	uint32 sufix_offset = 56;			// the offset of a sufix is for shifting the sufix towards MSB, to compare the sufix with a pattern
-	// Bytes of a pattern to search are always shifted towards MSB
-
-	uint32 row_index = 0;				// the number of a current row in an array kmer_data
-
-	bool found = false;
+	if (MIN(index_stop, static_cast<int64>(total_kmers) - 1) - index_start < static_cast<int64>(scan_threshold))
+		return ScanSufixes(index_start, index_stop, kmer_data, byte_alignment, counter);
+	if (sufix_layout == layout_eytzinger)
+		return EytzingerSearch(index_start, index_stop, kmer_data, byte_alignment, counter);
+	if (sufix_search == search_interpolation)
+		return InterpolationSearch(index_start, index_stop, kmer_data, byte_alignment, counter);
+	uint64 pattern[MAX_SUFIX_WORDS];
+	MakeSufixPattern(kmer_data, byte_alignment, pattern);
 
 	while (index_start <= index_stop)
 	{
 		int64 mid_index = (index_start + index_stop) / 2;
-		sufix_byte_ptr = &sufix_file_buf[mid_index * sufix_rec_size];
+		const uchar* record_ptr = sufix_file_buf + mid_index * sufix_rec_size;
+		int cmp = CompareSufix(record_ptr, pattern);
+		if (cmp == 0)
+			return ReadCounter(record_ptr, counter);
+		if (cmp < 0)
+			index_start = mid_index + 1;
+		else
+			index_stop = mid_index - 1;
+	}
+	return false;
+}
 
-		uint64 pattern = 0;
 
-		pattern_offset = (lut_prefix_length + kmer.byte_alignment) * 2;
+//---------------------------------------------------------------------------------
+// Rearrange the records of every LUT bucket into the Eytzinger order: an in-order walk
+// of the implicit tree takes the sorted records one by one. Auxiliary function.
+//---------------------------------------------------------------------------------
+void CKMCFile::RelayoutSufixBuckets()
+{
+	std::vector<uchar> bucket;
+	std::vector<uint64> path;
+	for (uint64 i = 0; i + 1 < prefix_file_buf_size; ++i)
+	{
+		uint64 start = prefix_file_buf[i];
+		uint64 stop = MIN(prefix_file_buf[i + 1], total_kmers);
+		if (stop <= start + 1)
+			continue;
+		uint64 n = stop - start;
+		uchar* records = sufix_file_buf + start * sufix_rec_size;
+		bucket.assign(records, records + n * sufix_rec_size);
+
+		//iterative in-order walk over nodes 1..n
+		uint64 next_sorted = 0;
+		uint64 node = 1;
+		while (node <= n || !path.empty())
+		{
+			for (; node <= n; node *= 2)
+				path.push_back(node);
+			node = path.back();
+			path.pop_back();
+			memcpy(records + (node - 1) * sufix_rec_size, &bucket[next_sorted++ * sufix_rec_size], sufix_rec_size);
+			node = 2 * node + 1;
+		}
+	}
+}
 
-		row_index = 0;
-		for (uint32 a = 0; a < sufix_size; a++)		//check byte by byte
+//---------------------------------------------------------------------------------
+// Search a sorted bucket by interpolation: the next probe is guessed from where the
+// kmer's leading suffix bytes fall between the keys bounding the range. A guess that
+// fails to halve the range (a skewed bucket) switches the rest of the search to
+// bisection. Auxiliary function.
+// IN : index_start, index_stop - the bucket, inclusive
+// OUT: counter                 - kmer's counter if kmer exists
+//---------------------------------------------------------------------------------
+bool CKMCFile::InterpolationSearch(int64 index_start, int64 index_stop, const uint64* kmer_data, uchar byte_alignment, uint64& counter)
+{
+	int64 low = index_start;
+	int64 high = MIN(index_stop, static_cast<int64>(total_kmers) - 1) + 1;
+	uint64 pattern[MAX_SUFIX_WORDS];
+	MakeSufixPattern(kmer_data, byte_alignment, pattern);
+	uint64 key = PatternKey(pattern);
+	uint64 low_key = 0;
+	uint64 high_key = MaxSufixKey();
+	bool interpolating = true;
+	while (low < high)
+	{
+		int64 probe = interpolating ? InterpolateProbe(low, high, low_key, high_key, key) : (low + high) / 2;
+		const uchar* record_ptr = sufix_file_buf + probe * sufix_rec_size;
+		int cmp = CompareSufix(record_ptr, pattern);
+		if (cmp == 0)
+			return ReadCounter(record_ptr, counter);
+		int64 range = high - low;
+		if (cmp < 0)
 		{
-			pattern = kmer.kmer_data[row_index];
-			pattern = pattern << pattern_offset;
-			pattern = pattern & 0xff00000000000000;
+			low = probe + 1;
+			low_key = SufixKey(record_ptr);
+		}
+		else
+		{
+			high = probe;
+			high_key = SufixKey(record_ptr);
+		}
+		if (2 * (high - low) > range)
+			interpolating = false;
+	}
+	return false;
+}
+
+//---------------------------------------------------------------------------------
+// Search a bucket stored in the Eytzinger order. Auxiliary function.
+// IN : index_start, index_stop - the bucket, inclusive
+// OUT: counter                 - kmer's counter if kmer exists
+//---------------------------------------------------------------------------------
+bool CKMCFile::EytzingerSearch(int64 index_start, int64 index_stop, const uint64* kmer_data, uchar byte_alignment, uint64& counter)
+{
+	int64 n = MIN(index_stop, static_cast<int64>(total_kmers) - 1) - index_start + 1;
+	const uchar* records = sufix_file_buf + index_start * sufix_rec_size;
+	uint64 pattern[MAX_SUFIX_WORDS];
+	MakeSufixPattern(kmer_data, byte_alignment, pattern);
+	for (int64 node = 1; node <= n;)
+	{
+		const uchar* record_ptr = records + (node - 1) * sufix_rec_size;
+		int cmp = CompareSufix(record_ptr, pattern);
+		if (cmp == 0)
+			return ReadCounter(record_ptr, counter);
+		node = 2 * node + (cmp < 0);
+	}
+	return false;
+}
+
+//---------------------------------------------------------------------------------
+// Small bucket scan kernels: compare the first suffix word (masked) of n <= 64 records
+// with key at once, without the branches of a search.
+// RET: bit i set if record i matches
+//---------------------------------------------------------------------------------
+typedef uint64 (*scan_kernel_t)(const uchar* records, uint32 n, uint32 rec_size, uint64 key, uint64 mask);
 
-			sufix = sufix_byte_ptr[a];
-			sufix = sufix << sufix_offset;
+static uint64 ScanSufixesScalar(const uchar* records, uint32 n, uint32 rec_size, uint64 key, uint64 mask)
+{
+	uint64 matches = 0;
+	for (uint32 i = 0; i < n; ++i)
+	{
+		uint64 word;
+		memcpy(&word, records + i * rec_size, sizeof(word));
+		matches |= (uint64)((my_bswap64(word) & mask) == key) << i;
+	}
+	return matches;
+}
 
-			if (pattern != sufix)
-				break;
+#ifdef KMC_SCAN_X86
+__attribute__((target("avx2"))) static uint64 ScanSufixesAVX2(const uchar* records, uint32 n, uint32 rec_size, uint64 key, uint64 mask)
+{
+	const __m256i bswap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+										   7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	const __m256i keys = _mm256_set1_epi64x((long long)key);
+	const __m256i masks = _mm256_set1_epi64x((long long)mask);
+	const __m256i step = _mm256_set1_epi64x(4ll * rec_size);
+	__m256i offsets = _mm256_setr_epi64x(0, rec_size, 2ll * rec_size, 3ll * rec_size);
+	uint64 matches = 0;
+	for (uint32 i = 0; i < n; i += 4)
+	{
+		//lanes past the bucket are not loaded, so nothing is read after the last record
+		__m256i active = _mm256_cmpgt_epi64(_mm256_set1_epi64x(n - i), _mm256_setr_epi64x(0, 1, 2, 3));
+		__m256i words = _mm256_mask_i64gather_epi64(_mm256_setzero_si256(), (const long long*)records, offsets, active, 1);
+		words = _mm256_and_si256(_mm256_shuffle_epi8(words, bswap), masks);
+		__m256i equal = _mm256_and_si256(_mm256_cmpeq_epi64(words, keys), active);
+		matches |= (uint64)_mm256_movemask_pd(_mm256_castsi256_pd(equal)) << i;
+		offsets = _mm256_add_epi64(offsets, step);
+	}
+	return matches;
+}
+
+__attribute__((target("avx512f,avx512bw"))) static uint64 ScanSufixesAVX512(const uchar* records, uint32 n, uint32 rec_size, uint64 key, uint64 mask)
+{
+	const __m512i bswap = _mm512_set4_epi32(0x08090a0b, 0x0c0d0e0f, 0x00010203, 0x04050607);
+	const __m512i keys = _mm512_set1_epi64((long long)key);
+	const __m512i masks = _mm512_set1_epi64((long long)mask);
+	const __m512i step = _mm512_set1_epi64(8ll * rec_size);
+	const long long r = rec_size;
+	__m512i offsets = _mm512_setr_epi64(0, r, 2 * r, 3 * r, 4 * r, 5 * r, 6 * r, 7 * r);
+	uint64 matches = 0;
+	for (uint32 i = 0; i < n; i += 8)
+	{
+		__mmask8 active = n - i >= 8 ? 0xff : (__mmask8)((1u << (n - i)) - 1);
+		__m512i words = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), active, offsets, records, 1);
+		words = _mm512_and_si512(_mm512_shuffle_epi8(words, bswap), masks);
+		matches |= (uint64)_mm512_mask_cmpeq_epi64_mask(active, words, keys) << i;
+		offsets = _mm512_add_epi64(offsets, step);
+	}
+	return matches;
+}
+#endif
+
+struct CScanKernel
+{
+	scan_kernel_t kernel;
+	const char* name;
+};
+
+static CScanKernel SelectScanKernel()
+{
+#ifdef KMC_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return {ScanSufixesAVX512, "avx512"};
+	if (__builtin_cpu_supports("avx2"))
+		return {ScanSufixesAVX2, "avx2"};
+#endif
+	return {ScanSufixesScalar, "scalar"};
+}
+
+// The best kernel for this CPU, picked on first use
+static const CScanKernel& ScanKernel()
+{
+	static const CScanKernel kernel = SelectScanKernel();
+	return kernel;
+}
 
-			pattern_offset += 8;
+const char* CKMCFile::ScanKernelName()
+{
+	return ScanKernel().name;
+}
+
+//---------------------------------------------------------------------------------
+// Scan a bucket of at most scan_threshold records, as BinarySearch dispatches them
+// (index_stop - index_start < scan_threshold). Records are only tested for equality,
+// so this works for the sorted and the Eytzinger layout alike. For suffixes longer
+// than a word, records whose first word matches are compared in full.
+// IN : index_start, index_stop - the bucket, inclusive
+// OUT: counter                 - kmer's counter if kmer exists
+//---------------------------------------------------------------------------------
+bool CKMCFile::ScanSufixes(int64 index_start, int64 index_stop, const uint64* kmer_data, uchar byte_alignment, uint64& counter)
+{
+	int64 n = MIN(index_stop, static_cast<int64>(total_kmers) - 1) - index_start + 1;
+	if (n <= 0)
+		return false;
+	uint64 pattern[MAX_SUFIX_WORDS];
+	MakeSufixPattern(kmer_data, byte_alignment, pattern);
+	uint64 key = sufix_words ? pattern[0] : 0;
+	uint64 mask = sufix_words > 1 ? ~0ull : (sufix_words ? sufix_last_mask : 0);
+
+	const uchar* records = sufix_file_buf + index_start * sufix_rec_size;
+	uint64 matches = ScanKernel().kernel(records, (uint32)n, sufix_rec_size, key, mask);
+	for (uint32 i = 0; matches; ++i, matches >>= 1)
+	{
+		const uchar* record_ptr = records + i * sufix_rec_size;
+		if ((matches & 1) && (sufix_words <= 1 || CompareSufix(record_ptr, pattern) == 0))
+			return ReadCounter(record_ptr, counter);
+	}
+	return false;
+}
+
+//---------------------------------------------------------------------------------
+// Build a split block Bloom filter over all records: each kmer sets one bit in each
+// of the 8 words of a 32-byte block, so a lookup reads half a cache line. Buckets are
+// hashed from load_threads threads, setting bits atomically. Records filtered out by
+// min_count or max_count are included, so the filter stays valid if they change.
+// IN : bits_per_kmer - size of the filter; 0 removes it
+// RET: true          - if the database is opened for random access
+//---------------------------------------------------------------------------------
+bool CKMCFile::BuildFilter(uint32 bits_per_kmer)
+{
+	ReleaseFilter();
+	if (is_opened != opened_for_RA)
+		return false;
+	if (bits_per_kmer == 0)
+		return true;
 
-			if (pattern_offset == 64)				//the end of a word
+	const uint64 block_bits = filter_block_words * 32;
+	filter_blocks = MIN((total_kmers * bits_per_kmer + block_bits - 1) / block_bits, (1ull << 32) - 1);
+	filter_blocks = std::max<uint64>(filter_blocks, 1);
+	filter_area.assign(filter_blocks * filter_block_words + filter_block_words, 0);
+	uint32* area = filter_area.data();
+	filter = area + (32 - (uintptr_t)area % 32) % 32 / sizeof(uint32);
+
+	const uint64 last_data_index = prefix_file_buf_size - 1;
+	const bool compressed = sufix_layout == layout_compressed;
+	const uint64 parts = compressed ? (elias_fano.high_values + ef_sample_step - 1) / ef_sample_step : last_data_index;
+	const uint64 chunk = 1 << 12;	// buckets (samples in layout_compressed) taken by a thread at a time
+	std::atomic<uint64> next_part(0);
+	auto add_kmer = [&](uint64 lut_pos, const uint64* pattern) {
+		uint64 hash = FilterHash(lut_pos, pattern);
+		uint32* block = const_cast<uint32*>(FilterBlock(hash));
+		for (uint32 i = 0; i < filter_block_words; ++i)
+			std::atomic_ref<uint32>(block[i]).fetch_or(1u << (((uint32)hash * filter_salt[i]) >> 27), std::memory_order_relaxed);
+	};
+	auto add_buckets = [&] {
+		uint64 pattern[MAX_SUFIX_WORDS];
+		for (uint64 begin; (begin = next_part.fetch_add(chunk)) < parts;)
+		{
+			if (compressed)
 			{
-				pattern_offset = 0;
-				row_index++;
+				ForEachEliasFanoRecord(begin, MIN(begin + chunk, parts), add_kmer);
+				continue;
+			}
+			for (uint64 lut_pos = begin; lut_pos < MIN(begin + chunk, parts); ++lut_pos)
+			{
+				uint64 stop = MIN(prefix_file_buf[lut_pos + 1], total_kmers);
+				for (uint64 index = prefix_file_buf[lut_pos]; index < stop; ++index)
+				{
+					const uchar* record_ptr = sufix_file_buf + index * sufix_rec_size;
+					for (uint32 w = 0; w < sufix_words; ++w)
+						pattern[w] = LoadSufixWord(record_ptr + 8 * w);
+					if (sufix_words)
+						pattern[sufix_words - 1] &= sufix_last_mask;
+					add_kmer(lut_pos, pattern);
+				}
 			}
 		}
+	};
+	std::vector<std::thread> workers;
+	for (uint32 i = 1; i < load_threads; ++i)
+		workers.emplace_back(add_buckets);
+	add_buckets();
+	for (auto& worker : workers)
+		worker.join();
+
+	filter_queries = filter_absent = filter_rejected = 0;
+	return true;
+}
 
-		if (pattern == sufix)
-		{
-			found = true;
-			break;
-		}
-		if (sufix < pattern)
-			index_start = mid_index + 1;
-		else
-			index_stop = mid_index - 1;
+//---------------------------------------------------------------------------------
+// Memory of the filter and the lookups it has seen since BuildFilter
+//---------------------------------------------------------------------------------
+CKMCFilterStats CKMCFile::GetFilterStats() const
+{
+	CKMCFilterStats stats{};
+	if (filter)
+	{
+		stats.bytes = filter_blocks * filter_block_words * sizeof(uint32);
+		stats.queries = filter_queries;
+		stats.absent = filter_absent;
+		stats.rejected = filter_rejected;
 	}
+	return stats;
+}
 
-	if (found)
+//---------------------------------------------------------------------------------
+// Memory of the RA buffers and the part of it backed by huge pages. smaps gives the
+// huge pages of whole mappings, which are counted up to the bytes of the buffers they
+// overlap, as the kernel may have merged a buffer's mapping with its neighbours.
+//---------------------------------------------------------------------------------
+CKMCPageStats CKMCFile::GetPageStats() const
+{
+	CKMCPageStats stats{};
+	if (is_opened != opened_for_RA)
+		return stats;
+	stats.pool_missed = huge_pool_missed;
+	std::vector<std::pair<uint64, uint64>> ranges;	//[begin, end) of the buffers
+	if (prefix_file_buf)
+		ranges.emplace_back((uint64)prefix_file_buf, (uint64)(prefix_file_buf + prefix_file_buf_size));
+	if (sufix_layout == layout_compressed)
 	{
-		if (counter_size == 0)
-			counter = 1;
-		else
+		const CEliasFano& ef = elias_fano;
+		ranges.emplace_back((uint64)ef.upper.base, (uint64)ef.upper.base + (ef.upper_bits + 7) / 8);
+		ranges.emplace_back((uint64)ef.lower.base, (uint64)ef.lower.base + (total_kmers * ef.low_bits + 7) / 8);
+		ranges.emplace_back((uint64)ef.counters.base, (uint64)ef.counters.base + (total_kmers * ef.counter_bits + 7) / 8);
+		ranges.emplace_back((uint64)ef.samples.base, (uint64)ef.samples.base + (ef.high_values / ef_sample_step + 2) * sizeof(uint64));
+	}
+	else
+		ranges.emplace_back((uint64)sufix_file_buf, (uint64)(sufix_file_buf + total_kmers * sufix_rec_size));
+	for (auto& range : ranges)
+		stats.bytes += range.second - range.first;
+
+#ifdef __linux__
+	std::ifstream smaps("/proc/self/smaps");
+	std::string line;
+	uint64 vma_begin = 0, vma_end = 0, vma_huge = 0;
+	auto add_vma = [&] {
+		for (auto& range : ranges)
 		{
-			sufix_byte_ptr += sufix_size;
-			counter = *sufix_byte_ptr;
-
-			for (uint32 b = 1; b < counter_size; b++)
+			uint64 begin = std::max(range.first, vma_begin), end = MIN(range.second, vma_end);
+			if (begin < end)
+				stats.huge_bytes += MIN(vma_huge, end - begin);
+		}
+	};
+	while (std::getline(smaps, line))
+	{
+		std::istringstream fields(line);
+		std::string key;
+		fields >> key;
+		if (!key.empty() && key.back() == ':')
+		{
+			if (key == "AnonHugePages:" || key == "ShmemPmdMapped:" || key == "FilePmdMapped:" ||
+				key == "Shared_Hugetlb:" || key == "Private_Hugetlb:")
 			{
-				uint64 aux = 0x000000ff & *(sufix_byte_ptr + b);
-
-				aux = aux << 8 * (b);
-				counter = aux | counter;
+				uint64 kb = 0;
+				fields >> kb;
+				vma_huge += kb << 10;
 			}
+			continue;
 		}
-		//applay filtering only if counter_size != 0
-		return (counter_size == 0) || ((counter >= min_count) && (counter <= max_count));
+		size_t dash = key.find('-');
+		if (dash == std::string::npos)
+			continue;
+		add_vma();
+		vma_begin = std::stoull(key.substr(0, dash), nullptr, 16);
+		vma_end = std::stoull(key.substr(dash + 1), nullptr, 16);
+		vma_huge = 0;
+	}
+	add_vma();
+#endif
+	return stats;
+}
+
+//---------------------------------------------------------------------------------
+// Memory of the suffix records and the LUT (or the samples replacing it), and what they
+// would take in layout_sorted with the counters kept (or dropped) the same way
+//---------------------------------------------------------------------------------
+CKMCSufixStats CKMCFile::GetSufixStats() const
+{
+	CKMCSufixStats stats{};
+	if (is_opened != opened_for_RA)
+		return stats;
+	stats.plain_bytes = total_kmers * sufix_rec_size + prefix_file_buf_size * sizeof(uint64);
+	stats.counter_bits = counter_size * 8;
+	if (sufix_layout != layout_compressed)
+	{
+		stats.bytes = stats.plain_bytes;
+		return stats;
+	}
+	const CEliasFano& ef = elias_fano;
+	stats.bytes = (ef.upper_bits + total_kmers * (ef.low_bits + ef.counter_bits) + 7) / 8 +
+		(ef.high_values / ef_sample_step + 2) * sizeof(uint64);
+	stats.high_bits = ef.high_bits;
+	stats.low_bits = ef.low_bits;
+	stats.counter_bits = ef.counter_bits;
+	return stats;
+}
+
+void CKMCFile::ReleaseFilter()
+{
+	filter_area = std::vector<uint32>();
+	filter = nullptr;
+	filter_blocks = 0;
+	filter_queries = filter_absent = filter_rejected = 0;
+}
+
+//---------------------------------------------------------------------------------
+// Shared memory segments. A segment starts with CSharedHeader, followed by the LUT, the
+// signature map (KMC2 only) and the suffix records with SUFIX_PADDING, each 4 KB aligned.
+// ready is set last, so a segment that is still being filled is never attached.
+//---------------------------------------------------------------------------------
+#ifndef _WIN32
+struct CSharedHeader
+{
+	char marker[8];
+	uint32 ready;
+	uint32 kmc_version;
+	uint32 kmer_length;
+	uint32 mode;
+	uint32 counter_size;
+	uint32 lut_prefix_length;
+	uint32 signature_len;
+	uint32 min_count;
+	uint64 max_count;
+	uint64 total_kmers;
+	uint32 both_strands;
+	uint32 layout;
+	uint32 single_LUT_size;
+	uint32 signature_map_size;
+	uint32 presence_only;				// loaded with load_presence_only, so records hold no counters
+	uint32 loaded_min_count;			// min_count applied while loading; kmers counted below it are not in the segment
+	uint64 prefix_file_buf_size;
+	uint64 prefix_offset, signature_offset, sufix_offset, segment_size;
+	uint64 source_size, source_mtime;	// of *.kmc_suf, to notice a database rewritten after loading
+	char source[PATH_MAX];				// canonical path of *.kmc_suf
+};
+
+static const char shared_marker[8] = {'K', 'M', 'C', 'S', 'H', 'M', '0', '2'};
+
+// A path on a mounted file system (e.g. hugetlbfs), or a POSIX shared memory name
+static bool IsSegmentPath(const std::string &segment)
+{
+	return segment.find('/', 1) != std::string::npos;
+}
+
+static int OpenSegment(const std::string &segment, int flags, mode_t mode = 0)
+{
+	if (IsSegmentPath(segment))
+		return open(segment.c_str(), flags, mode);
+	return shm_open(segment.c_str(), flags, mode);
+}
+
+// Identify the database behind file_name by its canonical *.kmc_suf path, size and mtime
+static bool DescribeSource(const std::string &file_name, CSharedHeader &header)
+{
+	struct stat st;
+	std::string suf = file_name + ".kmc_suf";
+	if (!realpath(suf.c_str(), header.source) || stat(suf.c_str(), &st) != 0)
+		return false;
+	header.source_size = st.st_size;
+	header.source_mtime = st.st_mtime;
+	return true;
+}
+#endif
+
+//---------------------------------------------------------------------------------
+// Copy the RA buffers into a new segment. An existing segment is not replaced.
+// RET	: true - if successful
+//---------------------------------------------------------------------------------
+bool CKMCFile::SaveToSharedMemory(const std::string &segment, const std::string &file_name) const
+{
+#ifndef _WIN32
+	if (is_opened != opened_for_RA || sufix_layout == layout_compressed)
+		return false;
+	CSharedHeader header = {};
+	if (!DescribeSource(file_name, header))
+		return false;
+	memcpy(header.marker, shared_marker, sizeof(shared_marker));
+	header.kmc_version = kmc_version;
+	header.kmer_length = kmer_length;
+	header.mode = mode;
+	header.counter_size = counter_size;
+	header.lut_prefix_length = lut_prefix_length;
+	header.signature_len = signature_len;
+	header.min_count = original_min_count;
+	header.max_count = original_max_count;
+	header.total_kmers = total_kmers;
+	header.both_strands = both_strands;
+	header.layout = sufix_layout;
+	header.single_LUT_size = single_LUT_size;
+	header.signature_map_size = kmc_version == 0x200 ? signature_map_size : 0;
+	header.presence_only = sufix_loaded == loaded_compacted;
+	header.loaded_min_count = header.presence_only ? min_count : original_min_count;
+	header.prefix_file_buf_size = prefix_file_buf_size;
+
+	uint64 sufix_bytes = total_kmers * sufix_rec_size;
+	header.prefix_offset = AlignUp(sizeof(CSharedHeader), 4096);
+	header.signature_offset = AlignUp(header.prefix_offset + prefix_file_buf_size * sizeof(uint64), 4096);
+	header.sufix_offset = AlignUp(header.signature_offset + header.signature_map_size * sizeof(uint32), 4096);
+
+	int fd = OpenSegment(segment, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return false;
+	uint64 block = 4096;
+#ifdef __linux__
+	struct statfs fs;
+	if (fstatfs(fd, &fs) == 0 && fs.f_bsize > 4096)
+		block = fs.f_bsize;		//the huge page size on hugetlbfs
+#endif
+	header.segment_size = AlignUp(header.sufix_offset + sufix_bytes + SUFIX_PADDING, block);
+
+	uchar* base = (uchar*)MAP_FAILED;
+	if (ftruncate(fd, header.segment_size) == 0)
+		base = (uchar*)mmap(nullptr, header.segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		RemoveSharedMemory(segment);
+		return false;
+	}
+#ifdef MADV_HUGEPAGE
+	//shared memory (tmpfs) allocates huge pages for advised mappings if shmem_enabled allows it
+	if (huge_mode != huge_none && block == 4096)
+		madvise(base, header.segment_size, MADV_HUGEPAGE);
+#endif
+
+	memcpy(base + header.prefix_offset, prefix_file_buf, prefix_file_buf_size * sizeof(uint64));
+	if (header.signature_map_size)
+		memcpy(base + header.signature_offset, signature_map, header.signature_map_size * sizeof(uint32));
+	memcpy(base + header.sufix_offset, sufix_file_buf, sufix_bytes);
+	memcpy(base, &header, sizeof(header));
+	__atomic_store_n(&((CSharedHeader*)base)->ready, 1u, __ATOMIC_RELEASE);
+	munmap(base, header.segment_size);
+	return true;
+#else
+	return false;
+#endif
+}
+
+//---------------------------------------------------------------------------------
+// Attach to a segment made by SaveToSharedMemory. The buffers point into the read-only
+// mapping, so nothing is loaded and the pages are shared with every attached process.
+// RET	: true - if successful
+//---------------------------------------------------------------------------------
+bool CKMCFile::OpenForRAShared(const std::string &segment, const std::string &file_name)
+{
+#ifndef _WIN32
+	if (is_opened || file_pre || file_suf)
+		return false;
+	CSharedHeader expected = {};
+	if (!DescribeSource(file_name, expected))
+		return false;
+
+	int fd = OpenSegment(segment, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	uchar* base = (uchar*)MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (uint64)st.st_size >= sizeof(CSharedHeader))
+		base = (uchar*)mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return false;
+
+	const CSharedHeader &header = *(const CSharedHeader*)base;
+	//the records a load with the current settings would keep, as ReadCompactSufixes selects them
+	expected.presence_only = (sufix_load & load_presence_only) != 0;
+	expected.loaded_min_count = header.min_count;
+	if (expected.presence_only && load_min_count > header.min_count && load_min_count <= header.max_count)
+		expected.loaded_min_count = load_min_count;
+	if (memcmp(header.marker, shared_marker, sizeof(shared_marker)) != 0 ||
+		__atomic_load_n(&header.ready, __ATOMIC_ACQUIRE) != 1 ||
+		header.segment_size != (uint64)st.st_size ||
+		strcmp(header.source, expected.source) != 0 ||
+		header.source_size != expected.source_size || header.source_mtime != expected.source_mtime ||
+		header.presence_only != expected.presence_only || header.loaded_min_count != expected.loaded_min_count)
+	{
+		munmap(base, st.st_size);
+		return false;
 	}
+
+#ifdef MADV_HUGEPAGE
+	if (huge_mode != huge_none)
+		madvise(base, header.segment_size, MADV_HUGEPAGE);
+#endif
+	shared_map = base;
+	shared_map_size = header.segment_size;
+	kmc_version = header.kmc_version;
+	kmer_length = header.kmer_length;
+	mode = header.mode;
+	counter_size = header.counter_size;
+	lut_prefix_length = header.lut_prefix_length;
+	signature_len = header.signature_len;
+	original_min_count = header.min_count;
+	min_count = header.loaded_min_count;
+	max_count = original_max_count = header.max_count;
+	total_kmers = header.total_kmers;
+	both_strands = header.both_strands;
+	sufix_layout = (suffix_layout)header.layout;
+	single_LUT_size = header.single_LUT_size;
+	signature_map_size = header.signature_map_size;
+	prefix_file_buf_size = header.prefix_file_buf_size;
+	SetSufixSizes();
+
+	//never written in random access mode; the mapping is read-only
+	prefix_file_buf = (uint64*)(base + header.prefix_offset);
+	signature_map = header.signature_map_size ? (uint32*)(base + header.signature_offset) : NULL;
+	sufix_file_buf = base + header.sufix_offset;
+	sufix_loaded = loaded_shared;
+
+	is_opened = opened_for_RA;
+	prefix_index = 0;
+	sufix_number = 0;
+	return true;
+#else
+	return false;
+#endif
+}
+
+//---------------------------------------------------------------------------------
+// Remove a segment made by SaveToSharedMemory.
+//---------------------------------------------------------------------------------
+bool CKMCFile::RemoveSharedMemory(const std::string &segment)
+{
+#ifndef _WIN32
+	if (IsSegmentPath(segment))
+		return unlink(segment.c_str()) == 0;
+	return shm_unlink(segment.c_str()) == 0;
+#else
 	return false;
+#endif
+}
+
+//---------------------------------------------------------------------------------
+// Unmap the shared segment, if attached, and forget the buffers pointing into it.
+// Auxiliary function.
+//---------------------------------------------------------------------------------
+void CKMCFile::ReleaseSharedSegment()
+{
+#ifndef _WIN32
+	if (!shared_map)
+		return;
+	munmap(shared_map, shared_map_size);
+	shared_map = nullptr;
+	prefix_file_buf = NULL;
+	signature_map = NULL;
+	sufix_file_buf = NULL;
+#endif
 }
 
 
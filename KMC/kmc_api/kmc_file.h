@@ -13,10 +13,13 @@
 
 #include "kmer_defs.h"
 #include "kmer_api.h"
+#include "mmer.h"
 #include <string>
 #include <vector>
 #include <memory>
 #include <cassert>
+#include <algorithm>
+#include <atomic>
 
 struct CKMCFileInfo
 {
@@ -31,6 +34,92 @@ struct CKMCFileInfo
 	uint64 total_kmers;
 };
 
+//------------------------------------------------------------------------------------------
+// Cost and effect of the filter built by CKMCFile::BuildFilter. Lookups are counted since
+// the filter was built; absent includes rejected, so rejected / absent is the share of
+// missing kmers that skipped the exact search.
+//------------------------------------------------------------------------------------------
+struct CKMCFilterStats
+{
+	uint64 bytes;		// memory held by the filter
+	uint64 queries;		// kmers looked up
+	uint64 absent;		// of these, kmers that do not exist
+	uint64 rejected;	// of these, kmers the filter turned away
+};
+
+//------------------------------------------------------------------------------------------
+// Pages behind the LUT and the suffix records in random access mode, see
+// CKMCFile::SetHugePages. Taken from /proc/self/smaps, so zero elsewhere than on Linux.
+//------------------------------------------------------------------------------------------
+struct CKMCPageStats
+{
+	uint64 bytes;		// memory of the LUT (or the samples of layout_compressed) and the suffix records
+	uint64 huge_bytes;	// of this, memory backed by huge pages (transparent or hugetlbfs)
+	uint64 pool_missed;	// memory meant for explicit huge pages that the hugetlbfs pool could not hold, on transparent ones instead
+};
+
+//------------------------------------------------------------------------------------------
+// Memory of the suffix records and what locates them (the LUT, or the samples of
+// layout_compressed) in random access mode, see CKMCFile::GetSufixStats. In
+// layout_compressed a record costs the low_bits of its key (bucket and suffix), about 2 bits
+// of the unary code of the key's high_bits, a share of the samples, and counter_bits.
+//------------------------------------------------------------------------------------------
+struct CKMCSufixStats
+{
+	uint64 bytes;			// memory of the records and the LUT or samples
+	uint64 plain_bytes;		// memory of the same records and the LUT in layout_sorted
+	uint32 high_bits;		// leading key bits coded in unary, layout_compressed only
+	uint32 low_bits;		// remaining key bits, stored as they are, layout_compressed only
+	uint32 counter_bits;	// bits of a counter, 0 if none are kept
+};
+
+//------------------------------------------------------------------------------------------
+// A batch of kmers looked up together by CKMCFile::CheckKmers. Kmers are added as packed
+// words in the CKmerAPI::to_long layout; counters come back in the order of adding, 0 for
+// kmers that do not exist. Buffers keep their capacity when the batch is reset.
+//------------------------------------------------------------------------------------------
+class CKmerBatch
+{
+public:
+	void reset(uint32 words_per_kmer)
+	{
+		words = words_per_kmer;
+		kmers.clear();
+		counters.clear();
+	}
+
+	void add(const uint64* kmer)
+	{
+		for (uint32 i = 0; i < words; ++i)
+			kmers.push_back(kmer[i]);
+	}
+
+	uint64 size() const { return kmers.size() / words; }
+
+	const uint64* kmer(uint64 i) const { return &kmers[i * words]; }
+
+	bool found(uint64 i) const { return counters[i] != 0; }
+
+	uint64 counter(uint64 i) const { return counters[i]; }
+
+private:
+	friend class CKMCFile;
+
+	struct CEntry
+	{
+		uint64 lut_pos;		// bucket of the kmer in prefix_file_buf
+		uint64 first_row;	// kmer_data[0], which orders kmers within a bucket for k <= 32
+		uint64 index;		// position of the kmer in the batch
+	};
+
+	uint32 words = 1;
+	std::vector<uint64> kmers;		// packed words, as added
+	std::vector<uint64> aligned;	// the same kmers laid out as CKmerAPI::kmer_data
+	std::vector<CEntry> entries;	// sorted by bucket, then by kmer
+	std::vector<uint64> hashes;		// filter hashes of the entries, see CKMCFile::BuildFilter
+	std::vector<uint64> counters;
+};
+
 class CKMCFile
 {
 	class CPrefixFileBufferForListingMode
@@ -41,6 +130,7 @@ class CKMCFile
 		uint64_t buffSize{};
 		uint64_t posInBuf{};
 		uint64_t leftToRead{};
+		uint64_t wholeLutSize;
 		uint64 prefixMask; //for kmc2 db
 		FILE* file;
 		bool isKMC1 = false;
@@ -65,6 +155,7 @@ class CKMCFile
 			:
 			buff(new uint64_t[buffCapacity]),
 			leftToRead(wholeLutSize),
+			wholeLutSize(wholeLutSize),
 			prefixMask((1ull << (2 * lutPrefixLen)) - 1),
 			file(file),
 			isKMC1(isKMC1),
@@ -73,6 +164,14 @@ class CKMCFile
 			my_fseek(file, 4 + 8, SEEK_SET); //	skip KMCP and LUT[0] (always = 0)
 		}
 
+		//start over from the first prefix, for RestartListing
+		void Restart()
+		{
+			buffPosInFile = buffSize = posInBuf = 0;
+			leftToRead = wholeLutSize;
+			my_fseek(file, 4 + 8, SEEK_SET);
+		}
+
 		//no control if next prefix exists here, responsibility to the caller
 		uint64_t GetPrefix(uint64_t suffix_number)
 		{
@@ -94,6 +193,49 @@ class CKMCFile
 			delete[] buff;
 		}
 	};
+public:
+	// Order of the suffix records inside each LUT bucket in random access mode
+	enum suffix_layout {
+		layout_sorted,		// as stored in *.kmc_suf
+		layout_eytzinger,	// implicit binary tree (root first, children of node i at 2i and 2i + 1, 1-based)
+		layout_compressed	// Elias-Fano coded suffixes and bit-packed counters, decoded in part by each lookup
+	};
+
+	// How sorted buckets are searched in random access mode
+	enum search_mode {
+		search_binary,			// halve the range at every probe
+		search_interpolation	// guess the position from the numeric suffix value, bisecting once guesses stop halving the range
+	};
+
+	// How OpenForRA brings *.kmc_suf into memory; flags may be or-ed
+	enum load_flags {
+		load_read = 0,		// read the file into a heap buffer
+		load_mmap = 1,		// map the file: lookups start at once, pages are loaded on first access and shared between processes
+		load_populate = 2,	// with load_mmap, fault all pages in while opening (MAP_POPULATE)
+		load_random = 4,	// with load_mmap, no readahead around accessed pages (MADV_RANDOM)
+		load_hugepage = 8,	// with load_mmap, back the mapping with transparent huge pages where the file system allows (MADV_HUGEPAGE)
+		load_presence_only = 16	// read the file dropping counters, so records hold only suffixes; every kmer found counts 1. Overrides load_mmap
+	};
+
+	// Pages OpenForRA allocates the LUT and the suffix records on, when it reads the files
+	enum huge_pages {
+		huge_none,			// normal pages, unless the system backs all memory with transparent huge pages
+		huge_transparent,	// 2 MB aligned, advised to be backed by transparent huge pages (MADV_HUGEPAGE)
+		huge_explicit_2m,	// 2 MB pages reserved in the hugetlbfs pool (MAP_HUGETLB) for buffers of 2 MB or more, else huge_transparent
+		huge_explicit_1g	// 1 GB pages reserved in the hugetlbfs pool for buffers of 1 GB or more, else huge_transparent
+	};
+
+	// How the suffix records of the open database came into memory, whatever load_flags asked for
+	enum sufix_load_mode {
+		loaded_none,		// not opened for random access
+		loaded_read,		// *.kmc_suf read into a buffer, also when mapping it failed
+		loaded_mapped,		// *.kmc_suf mapped (load_mmap)
+		loaded_populated,	// *.kmc_suf mapped and faulted in while opening (load_populate)
+		loaded_compacted,	// read without counters (load_presence_only)
+		loaded_elias_fano,	// coded for layout_compressed, which ignores load_mmap
+		loaded_shared		// attached to a shared memory segment (OpenForRAShared)
+	};
+
 protected:
 	enum open_mode {closed, opened_for_RA, opened_for_listing};
 	open_mode is_opened;
@@ -115,6 +257,43 @@ protected:
 	uint32 signature_map_size;
 	
 	uchar* sufix_file_buf;
+	uchar* sufix_map = nullptr;		// the mapping holding sufix_file_buf with load_mmap, which starts after the marker
+	uint64 sufix_map_size = 0;
+	uchar* shared_map = nullptr;	// a shared memory segment holding all RA buffers, see OpenForRAShared
+	uint64 shared_map_size = 0;
+
+	// An anonymous mapping holding a buffer read in random access mode, see AllocateArea
+	struct CArea
+	{
+		void* base = nullptr;
+		uint64 size = 0;
+	};
+	CArea prefix_area;				// holds prefix_file_buf, unless attached to a shared segment
+	CArea sufix_area;				// holds sufix_file_buf when read (not mapped, listed or shared)
+
+	// The records in layout_compressed, which leaves sufix_file_buf NULL and frees the LUT. A
+	// record's key is its bucket (lut_bits bits) followed by its suffix, so keys increase with
+	// the records and form one Elias-Fano sequence: a key is split into its high_bits leading
+	// bits and the low_bits remaining ones, low_bits being picked so that there are about as
+	// many high values as records. Record i sets bit high + i of upper (LSB first), so that the
+	// zeros before it count the high values below its own, and the records of one high value
+	// are a run of ones. samples[j] is where the run of high value j * ef_sample_step starts, so
+	// that a select skips fewer zeros than that. The low bits are packed in lower (MSB first),
+	// the counters in counters (LSB first). Every array has a word of padding. See
+	// ReadEliasFanoSufixes
+	struct CEliasFano
+	{
+		uint32 lut_bits = 0;		// bits of a bucket, ahead of the suffix in a key
+		uint32 high_bits = 0;
+		uint32 low_bits = 0;
+		uint32 low_words = 0;		// 64-bit words covering low_bits
+		uint64 low_last_mask = 0;	// bits of the last of these words that belong to the key
+		uint32 counter_bits = 0;	// 0 if counters are dropped
+		uint64 high_values = 0;		// the largest high value of a key, plus 1
+		uint64 upper_bits = 0;		// length of upper: a one per record and a zero per high value
+		CArea upper, lower, counters, samples;
+	};
+	CEliasFano elias_fano;
 	uint64 sufix_number;			// The sufix's number to be listed
 	uint64 index_in_partial_buf;	// The current byte's number in an array "sufix_file_buf", for listing mode
 
@@ -131,13 +310,162 @@ protected:
 	uint32 kmc_version;
 	uint32 sufix_size;		// sufix's size in bytes 
 	uint32 sufix_rec_size;  // sufix_size + counter_size
+	uint32 sufix_words;		// 64-bit words covering a suffix, as compared by CompareSufix
+	uint64 sufix_last_mask;	// bits of the last of these words that belong to the suffix
 
 	uint32 original_min_count;
 	uint64 original_max_count;
 
+	static const uint32 lookup_lanes = 16;	// searches advanced in lockstep by CheckKmers
+	static const uint32 scan_threshold = 8;	// buckets of at most this many records are scanned, not searched (<= 64)
+	static const uint32 ef_sample_step = 256;	// high values between samples of layout_compressed, see CEliasFano
+
 	static uint64 part_size; // the size of a block readed to sufix_file_buf, in listing mode 
+
+	suffix_layout sufix_layout = layout_sorted;	// order of records inside buckets, random access mode only
+	search_mode sufix_search = search_binary;	// search of sorted buckets, random access mode only
+	uint32 sufix_load = load_read;				// load_flags of the next OpenForRA
+	uint32 load_threads = 1;					// threads reading the files in OpenForRA
+	uint32 load_min_count = 0;					// with load_presence_only, records counted below this are dropped
+	huge_pages huge_mode = huge_transparent;	// pages of the buffers read by OpenForRA
+	uint64 huge_pool_missed = 0;				// bytes of buffers AllocateArea could not put on explicit huge pages
+	sufix_load_mode sufix_loaded = loaded_none;	// how the open database holds its suffix records
+
+	static const uint32 filter_block_words = 8;	// a block of the filter: 8 32-bit words, one bit set in each per kmer
+	static const uint32 filter_distance = 16;	// blocks prefetched ahead by CheckKmers
+	static constexpr uint32 filter_salt[filter_block_words] = {0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+															   0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u};	// multipliers picking the bit of each block word
+	std::vector<uint32> filter_area;			// owns the filter, with room to align it
+	uint32* filter = nullptr;					// filter_blocks blocks aligned to 32 bytes, see BuildFilter; nullptr if none
+	uint64 filter_blocks = 0;
+	std::atomic<uint64> filter_queries{0}, filter_absent{0}, filter_rejected{0};
+
+	// Hash of a kmer's bucket and suffix (made by MakeSufixPattern), which the filter is keyed on. Auxiliary function.
+	uint64 FilterHash(uint64 lut_pos, const uint64* pattern) const;
+
+	// The filter block of a hash. Auxiliary function.
+	const uint32* FilterBlock(uint64 hash) const { return filter + ((hash >> 32) * filter_blocks >> 32) * filter_block_words; }
+
+	// False if no kmer of the database has this hash. Auxiliary function.
+	bool FilterContains(uint64 hash) const;
+
+	// Count a single lookup in the filter counts; false (and counted absent) if the filter rules the kmer out. Auxiliary function.
+	bool FilterAdmits(uint64 lut_pos, const uint64* kmer_data, uchar byte_alignment);
+
+	// Free the filter and reset its counts. Auxiliary function.
+	void ReleaseFilter();
+
+	// Read *.kmc_suf without counters, for load_presence_only. Auxiliary function.
+	bool ReadCompactSufixes();
+
+	// Read *.kmc_suf into the Elias-Fano coding of layout_compressed. Auxiliary function.
+	bool ReadEliasFanoSufixes();
+
+	// Search layout_compressed for the suffix of a bucket made by MakeSufixPattern. Auxiliary function.
+	bool EliasFanoSearch(uint64 lut_pos, const uint64* pattern, uint64& counter) const;
+
+	// Search layout_compressed for a key split by EliasFanoKey. Auxiliary function.
+	bool EliasFanoFind(uint64 high, const uint64* low, uint64& counter) const;
+
+	// Prefetch the likely records of a high value of layout_compressed for CheckEliasFanoKmers. Auxiliary function.
+	void PrefetchEliasFano(uint64 high) const;
+
+	// Look up the kmers of a batch in layout_compressed; see CheckKmers. Auxiliary function.
+	uint64 CheckEliasFanoKmers(CKmerBatch &batch, uint32 no_of_rows, uchar byte_alignment);
+
+	// Call visit(lut_pos, pattern) with every record of layout_compressed whose high value is in [first_sample,
+	// last_sample) * ef_sample_step, the suffix as MakeSufixPattern makes it. Auxiliary function.
+	template<typename F> void ForEachEliasFanoRecord(uint64 first_sample, uint64 last_sample, F&& visit) const;
+
+	// Split the key of a bucket and a suffix made by MakeSufixPattern into its high value and low bits, MSB
+	// aligned in low_words words. Auxiliary function.
+	void EliasFanoKey(uint64 lut_pos, const uint64* pattern, uint64 &high, uint64* low) const;
+
+	// Compare the low bits of a record of layout_compressed with those of a kmer. Auxiliary function.
+	int CompareEliasFanoLow(uint64 index, const uint64* low) const;
+
+	// Read the counter of a record of layout_compressed, as ReadCounter. Auxiliary function.
+	bool ReadEliasFanoCounter(uint64 index, uint64 &counter) const;
+
+	// Add the lookups of CheckKmers to the filter counts. Auxiliary function.
+	void CountFilterLookups(uint64 queries, uint64 found, uint64 rejected);
+
+	// Read size bytes at offset of file with up to load_threads threads, each on its own range. Auxiliary function.
+	bool ReadParallel(FILE* file, uint64 offset, void* buf, uint64 size) const;
+
+	// Map *.kmc_suf, of size bytes between the markers, into sufix_file_buf. Auxiliary function.
+	bool MapSufixFile(uint64 size, bool writable);
+
+	// Free or unmap sufix_file_buf. Auxiliary function.
+	void ReleaseSufixBuffer();
+
+	// Map size zeroed bytes on the pages chosen by huge_mode, returning the start of the buffer. Auxiliary function.
+	void* AllocateArea(uint64 size, CArea& area);
+
+	// Unmap an area of AllocateArea. Auxiliary function.
+	static void FreeArea(CArea& area);
+
+	// Detach from a shared memory segment, which holds prefix_file_buf, signature_map and sufix_file_buf. Auxiliary function.
+	void ReleaseSharedSegment();
+
+	// Close the files and release every buffer, also after an open that failed part way. Auxiliary function.
+	void ReleaseAll();
+
+	// Derive sufix_size and the related sizes from kmer_length, lut_prefix_length and counter_size. Auxiliary function.
+	void SetSufixSizes();
+
+	// Rearrange the records of every bucket into the Eytzinger order. Auxiliary function.
+	void RelayoutSufixBuckets();
+
+	// Scan a small bucket of any layout record by record. Auxiliary function.
+	bool ScanSufixes(int64 index_start, int64 index_stop, const uint64* kmer_data, uchar byte_alignment, uint64& counter);
+
+	// Search a sorted bucket by interpolation. Auxiliary function.
+	bool InterpolationSearch(int64 index_start, int64 index_stop, const uint64* kmer_data, uchar byte_alignment, uint64& counter);
+
+	// Leading (at most 8) bytes of a suffix record, as a big-endian number. Auxiliary function.
+	uint64 SufixKey(const uchar* record_ptr) const;
+
+	// The same bytes of a pattern made by MakeSufixPattern. Auxiliary function.
+	uint64 PatternKey(const uint64* pattern) const;
+
+	// The largest possible SufixKey. Auxiliary function.
+	uint64 MaxSufixKey() const;
+
+	// Guess the position of key among the records [low, high), whose keys lie in [low_key, high_key]. Auxiliary function.
+	static int64 InterpolateProbe(int64 low, int64 high, uint64 low_key, uint64 high_key, uint64 key);
+
+	// Search a bucket stored in the Eytzinger order. Auxiliary function.
+	bool EytzingerSearch(int64 index_start, int64 index_stop, const uint64* kmer_data, uchar byte_alignment, uint64& counter);
 	
-	bool BinarySearch(int64 index_start, int64 index_stop, const CKmerAPI& kmer, uint64& counter, uint32 pattern_offset);
+	bool BinarySearch(int64 index_start, int64 index_stop, const uint64* kmer_data, uchar byte_alignment, uint64& counter);
+
+	// Signature of a kmer stored as in CKmerAPI::kmer_data. Auxiliary function.
+	template<uint32 KMER_LEN> uint32 GetSignature(const uint64* kmer_data, uchar byte_alignment) const;
+
+	// Look up a kmer stored as in CKmerAPI::kmer_data. Auxiliary function.
+	template<uint32 KMER_LEN> bool CheckAlignedKmer(const uint64* kmer_data, uchar byte_alignment, uint64 &count);
+
+	// Position of a kmer's bucket in prefix_file_buf; false if the kmer cannot exist. Auxiliary function.
+	template<uint32 KMER_LEN> bool GetLutPosition(const uint64* kmer_data, uchar byte_alignment, uint64 &lut_pos) const;
+
+	// Suffix of a kmer stored as in CKmerAPI::kmer_data, as sufix_words big-endian words. Auxiliary function.
+	void MakeSufixPattern(const uint64* kmer_data, uchar byte_alignment, uint64* pattern) const;
+
+	// Load 8 bytes of a suffix record as a big-endian word. Auxiliary function.
+	static uint64 LoadSufixWord(const uchar* ptr);
+
+	// Compare the suffix record at record_ptr with a pattern made by MakeSufixPattern. Auxiliary function.
+	int CompareSufix(const uchar* record_ptr, const uint64* pattern) const;
+
+	// CompareSufix for suffixes of WORDS words (0 - any, sufix_words). Auxiliary function.
+	template<uint32 WORDS> int CompareSufixWords(const uchar* record_ptr, const uint64* pattern) const;
+
+	// Read the counter of the suffix record at record_ptr; false if it is filtered out. Auxiliary function.
+	bool ReadCounter(const uchar* record_ptr, uint64 &counter) const;
+
+	// Shared body of the ReadNextKmer overloads. Auxiliary function.
+	template<typename KMER, typename COUNT> bool ReadNextKmerImpl(KMER &kmer, COUNT &count);
 
 	// Open a file, recognize its size and check its marker. Auxiliary function.
 	bool OpenASingleFile(const std::string &file_name, FILE *&file_handler, uint64 &size, char marker[]);	
@@ -163,16 +491,32 @@ protected:
 	// Implementation of GetCountersForRead for kmc2 database format
 	bool GetCountersForRead_kmc2(const std::string& read, std::vector<uint32>& counters);
 public:
-		
 	CKMCFile();
 	~CKMCFile();
 
-	// Open files *.kmc_pre & *.kmc_suf, read them to RAM, close files. *.kmc_suf is opened for random access
-	bool OpenForRA(const std::string &file_name);
+	// Open files *.kmc_pre & *.kmc_suf, read them to RAM, close files. *.kmc_suf is opened for random access.
+	// With layout_eytzinger the records of each bucket are rearranged once at load time, so that searches
+	// touch a few cache lines near the root instead of jumping through the whole bucket
+	bool OpenForRA(const std::string &file_name, suffix_layout layout = layout_sorted);
 
 	// Open files *kmc_pre & *.kmc_suf, read *.kmc_pre to RAM, *.kmc_suf is buffered
 	bool OpenForListing(const std::string& file_name);
 
+	// Copy the buffers of a database opened for random access into a new shared memory segment, which outlives
+	// the process. segment is a POSIX shared memory name ("/name") or a file path on a mounted file system
+	// (e.g. hugetlbfs, for huge pages). file_name identifies the database for OpenForRAShared. layout_compressed
+	// databases cannot be shared
+	bool SaveToSharedMemory(const std::string &segment, const std::string &file_name) const;
+
+	// Attach read-only to a segment made by SaveToSharedMemory, instead of loading the files. Fails if the
+	// segment does not exist, is not complete or was made from another file_name (or an older copy of it), and
+	// if it was loaded with (or without) load_presence_only when this object is set otherwise, or with
+	// load_presence_only but a load_min_count that keeps other kmers (see SetLoadFlags, SetLoadMinCount)
+	bool OpenForRAShared(const std::string &segment, const std::string &file_name);
+
+	// Remove a segment made by SaveToSharedMemory; processes attached to it keep their mapping
+	static bool RemoveSharedMemory(const std::string &segment);
+
 	// Return true if kmc is in KMC2 compatiblie format
 	bool IsKMC2() const noexcept { return kmc_version == 0x200; }
 
@@ -180,9 +524,57 @@ public:
 	bool ReadNextKmer(CKmerAPI &kmer, uint64 &count); //for small k-values when counter may be longer than 4bytes
 	
 	bool ReadNextKmer(CKmerAPI &kmer, uint32 &count);
+
+	bool ReadNextKmer(CKmerValue &kmer, uint64 &count);
+
+	bool ReadNextKmer(CKmerValue &kmer, uint32 &count);
 	// Release memory and close files in case they were opened 
 	bool Close();
 
+	// Set how sorted buckets are searched in random access mode. Eytzinger buckets are not affected
+	void SetSearchMode(search_mode mode) { sufix_search = mode; }
+
+	// Set how the next OpenForRA loads *.kmc_suf (load_flags). Mapping is not available on Windows, where the
+	// file is always read. layout_eytzinger rewrites the buckets, which makes the mapped pages private copies
+	void SetLoadFlags(uint32 flags) { sufix_load = flags; }
+
+	// Set how many threads OpenForRA reads *.kmc_pre and *.kmc_suf with. Parallel filesystems often give a
+	// single stream a fraction of their bandwidth
+	void SetLoadThreads(uint32 threads) { load_threads = threads ? threads : 1; }
+
+	// With load_presence_only, drop kmers counted below x while loading, as SetMinCount would hide them
+	void SetLoadMinCount(uint32 x) { load_min_count = x; }
+
+	// Set the pages the next OpenForRA reads the LUT and the suffix records into (huge_pages). Huge pages save
+	// most TLB misses of random lookups. Explicit ones need pages reserved in /proc/sys/vm/nr_hugepages (or
+	// the hugepages-1048576kB pool); without them transparent ones are used. A shared segment is advised to
+	// use transparent huge pages unless huge_none
+	void SetHugePages(huge_pages mode) { huge_mode = mode; }
+
+	// Memory of the LUT and the suffix records, and how much of it is on huge pages now
+	CKMCPageStats GetPageStats() const;
+
+	// Memory of the suffix records and the LUT against the sorted layout, and how layout_compressed codes them
+	CKMCSufixStats GetSufixStats() const;
+
+	// Order of records inside buckets in random access mode
+	suffix_layout GetSuffixLayout() const { return sufix_layout; }
+
+	// How the suffix records were actually loaded, which differs from SetLoadFlags when mapping fails or
+	// the layout or a shared segment overrides it
+	sufix_load_mode GetSufixLoadMode() const { return sufix_loaded; }
+
+	// Instruction set used to scan small buckets on this CPU: "avx512", "avx2" or "scalar"
+	static const char* ScanKernelName();
+
+	// Build a blocked Bloom filter of about bits_per_kmer bits per kmer (with load_threads threads), which
+	// random access lookups (CheckKmer, CheckKmers, IsKmer and GetCountersForRead) check before searching
+	// a bucket. Most absent kmers then cost one cache line instead of a search; at 10 bits about 1% still pass
+	bool BuildFilter(uint32 bits_per_kmer);
+
+	// Memory of the filter and how many lookups it rejected; all zero without a filter
+	CKMCFilterStats GetFilterStats() const;
+
 	// Set the minimal value for a counter. Kmers with counters below this theshold are ignored
 	bool SetMinCount(uint32 x);
 
@@ -215,9 +607,27 @@ public:
 
 	bool CheckKmer(CKmerAPI &kmer, uint64 &count);
 
+	// Return true if kmer exists. The kmer is given as packed words in the CKmerAPI::to_long layout.
+	// KMER_LEN fixes the kmer length at compile time (it must be equal to KmerLength()), 0 takes it from the database
+	bool CheckKmer(const uint64* kmer, uint32 &count);
+
+	template<uint32 KMER_LEN = 0> bool CheckKmer(const uint64* kmer, uint64 &count);
+
+	bool CheckKmer(const CKmerValue &kmer, uint32 &count);
+
+	bool CheckKmer(const CKmerValue &kmer, uint64 &count);
+
+	// Look up all kmers of a batch, grouped by LUT bucket. Return the number of kmers that exist
+	template<uint32 KMER_LEN = 0> uint64 CheckKmers(CKmerBatch &batch);
+
 	// Return true if kmer exists
 	bool IsKmer(CKmerAPI &kmer);
 
+	bool IsKmer(const CKmerValue &kmer);
+
+	// Return true if kmer (packed words in the CKmerAPI::to_long layout) exists
+	template<uint32 KMER_LEN = 0> bool IsKmer(const uint64* kmer);
+
 	// Set original (readed from *.kmer_pre) values for min_count and max_count
 	void ResetMinMaxCounts(void);
 
@@ -234,6 +644,594 @@ public:
 		uint32 count_for_kmer_kmc2(CKmerAPI& kmer, uint32 bin_start_pos);
 };
 
+//------------------------------------------------------------------------------------------
+// Check if kmer exists. 
+// IN : kmer  - kmer as packed words in the CKmerAPI::to_long layout, ceil(kmer_length / 32) words
+// OUT: count - kmer's counter if kmer exists
+// RET: true  - if kmer exists
+// With KMER_LEN != 0 the alignment, the number of rows and the signature loop are compile-time constants
+//------------------------------------------------------------------------------------------
+template<uint32 KMER_LEN> bool CKMCFile::CheckKmer(const uint64* kmer, uint64 &count)
+{
+	static_assert(KMER_LEN <= MAX_K, "kmer length above MAX_K");
+	const uint32 len = KMER_LEN ? KMER_LEN : kmer_length;
+	if (len > MAX_K)
+		return false;
+	const uchar byte_alignment = (len % 4) ? 4 - (len % 4) : 0;
+	const uint32 no_of_rows = (len + byte_alignment + 31) / 32;
+	const uint32 offset = 62 - ((len - 1 + byte_alignment) & 31) * 2;
+
+	//shift the words towards MSB, the same way CKmerAPI stores them
+	uint64 kmer_data[MAX_KMER_ROWS];
+	if (offset)
+	{
+		for (uint32 i = 0; i + 1 < no_of_rows; ++i)
+			kmer_data[i] = (kmer[i] << offset) + (kmer[i + 1] >> (64 - offset));
+		kmer_data[no_of_rows - 1] = kmer[no_of_rows - 1] << offset;
+	}
+	else
+	{
+		for (uint32 i = 0; i < no_of_rows; ++i)
+			kmer_data[i] = kmer[i];
+	}
+	return CheckAlignedKmer<KMER_LEN>(kmer_data, byte_alignment, count);
+}
+
+//------------------------------------------------------------------------------------------
+// Check if kmer exists. 
+// IN : kmer_data      - kmer as in CKmerAPI::kmer_data
+// IN : byte_alignment - its byte alignment
+// OUT: count          - kmer's counter if kmer exists
+// RET: true           - if kmer exists
+//------------------------------------------------------------------------------------------
+template<uint32 KMER_LEN> bool CKMCFile::CheckAlignedKmer(const uint64* kmer_data, uchar byte_alignment, uint64 &count)
+{
+	if (is_opened != opened_for_RA)
+		return false;
+	if (end_of_file)
+		return false;
+
+	uint64 lut_pos;
+	if (!GetLutPosition<KMER_LEN>(kmer_data, byte_alignment, lut_pos))
+		return false;
+	if (filter && !FilterAdmits(lut_pos, kmer_data, byte_alignment))
+		return false;
+	bool res;
+	if (sufix_layout == layout_compressed)
+	{
+		uint64 pattern[MAX_SUFIX_WORDS];
+		MakeSufixPattern(kmer_data, byte_alignment, pattern);
+		res = EliasFanoSearch(lut_pos, pattern, count);
+	}
+	else
+	{
+		//look into the array with data
+		int64 index_start = prefix_file_buf[lut_pos];
+		int64 index_stop = prefix_file_buf[lut_pos + 1] - 1;
+		res = BinarySearch(index_start, index_stop, kmer_data, byte_alignment, count);
+	}
+	if (filter && !res)
+		filter_absent.fetch_add(1, std::memory_order_relaxed);
+	return res;
+}
+
+//------------------------------------------------------------------------------------------
+// Find the bucket of a kmer: its prefix, in the LUT of its signature bin for KMC2
+// IN : kmer_data      - kmer as in CKmerAPI::kmer_data
+// IN : byte_alignment - its byte alignment
+// OUT: lut_pos        - index into prefix_file_buf of the bucket start; the bucket ends
+//                       before prefix_file_buf[lut_pos + 1]
+// RET: false          - if the prefix is out of range
+//------------------------------------------------------------------------------------------
+template<uint32 KMER_LEN> bool CKMCFile::GetLutPosition(const uint64* kmer_data, uchar byte_alignment, uint64 &lut_pos) const
+{
+	//recognize a prefix:
+	uint32 pattern_offset = (sizeof(uint64) * 8) - (lut_prefix_length * 2) - (byte_alignment * 2);
+	uint64 pattern_prefix_value = kmer_data[0] >> pattern_offset;  //complements with 0
+	if (pattern_prefix_value >= prefix_file_buf_size)
+		return false;
+
+	lut_pos = pattern_prefix_value;
+	if (kmc_version == 0x200)
+	{
+		uint32 signature = GetSignature<KMER_LEN>(kmer_data, byte_alignment);
+		lut_pos += (uint64)signature_map[signature] * single_LUT_size;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------------------------
+// Build the suffix of a kmer as big-endian words, so that a record compares with it a word
+// at a time. Bits past the suffix are cleared, as CompareSufix masks them in the record.
+// OUT: pattern - sufix_words words
+//------------------------------------------------------------------------------------------
+inline void CKMCFile::MakeSufixPattern(const uint64* kmer_data, uchar byte_alignment, uint64* pattern) const
+{
+	uint32 rows = (kmer_length + byte_alignment + 31) / 32;
+	uint32 offset = (lut_prefix_length + byte_alignment) * 2;	//suffix bits start here, counted from the MSB of kmer_data[0]
+	for (uint32 w = 0; w < sufix_words; ++w)
+	{
+		uint32 row = (offset >> 6) + w;
+		uint32 shift = offset & 63;
+		uint64 word = kmer_data[row] << shift;
+		if (shift && row + 1 < rows)
+			word |= kmer_data[row + 1] >> (64 - shift);
+		pattern[w] = word;
+	}
+	if (sufix_words)
+		pattern[sufix_words - 1] &= sufix_last_mask;
+}
+
+//------------------------------------------------------------------------------------------
+// Filter hash: the bucket and the suffix words mixed a word at a time, then finalized as in
+// MurmurHash3. The high half picks the block, the low half the bit in each block word.
+//------------------------------------------------------------------------------------------
+inline uint64 CKMCFile::FilterHash(uint64 lut_pos, const uint64* pattern) const
+{
+	uint64 h = lut_pos * 0x9e3779b97f4a7c15ull;
+	for (uint32 w = 0; w < sufix_words; ++w)
+	{
+		h = (h ^ pattern[w]) * 0xbf58476d1ce4e5b9ull;
+		h ^= h >> 31;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+inline bool CKMCFile::FilterContains(uint64 hash) const
+{
+	const uint32* block = FilterBlock(hash);
+	uint32 key = (uint32)hash;
+	bool contains = true;
+	for (uint32 i = 0; i < filter_block_words; ++i)
+		contains &= (block[i] >> ((key * filter_salt[i]) >> 27)) & 1;
+	return contains;
+}
+
+//------------------------------------------------------------------------------------------
+// Check a kmer about to be searched alone (not in a CKmerBatch) against the filter,
+// counting the lookup. A kmer it lets through is counted absent by the caller if the
+// search does not find it.
+// IN : lut_pos        - the kmer's bucket, as of GetLutPosition
+// IN : kmer_data      - kmer as in CKmerAPI::kmer_data
+// IN : byte_alignment - its byte alignment
+// RET: false          - if the kmer is not in the database
+//------------------------------------------------------------------------------------------
+inline bool CKMCFile::FilterAdmits(uint64 lut_pos, const uint64* kmer_data, uchar byte_alignment)
+{
+	filter_queries.fetch_add(1, std::memory_order_relaxed);
+	uint64 pattern[MAX_SUFIX_WORDS];
+	MakeSufixPattern(kmer_data, byte_alignment, pattern);
+	if (FilterContains(FilterHash(lut_pos, pattern)))
+		return true;
+	filter_rejected.fetch_add(1, std::memory_order_relaxed);
+	filter_absent.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+//------------------------------------------------------------------------------------------
+// Load 8 bytes as a big-endian word. Records near the end of sufix_file_buf are covered by
+// SUFIX_PADDING.
+//------------------------------------------------------------------------------------------
+inline uint64 CKMCFile::LoadSufixWord(const uchar* ptr)
+{
+	uint64 word;
+	memcpy(&word, ptr, sizeof(word));
+	return my_bswap64(word);
+}
+
+//------------------------------------------------------------------------------------------
+// Compare a suffix record with a pattern a word at a time
+// RET: < 0, 0, > 0 - if the record is smaller than, equal to or greater than the kmer's suffix
+//------------------------------------------------------------------------------------------
+template<uint32 WORDS> inline int CKMCFile::CompareSufixWords(const uchar* record_ptr, const uint64* pattern) const
+{
+	const uint32 words = WORDS ? WORDS : sufix_words;
+	for (uint32 w = 0; w < words; ++w)
+	{
+		uint64 word = LoadSufixWord(record_ptr + 8 * w);
+		if (w + 1 == words)
+			word &= sufix_last_mask;		//the rest are counter bytes or the next record
+		if (word != pattern[w])
+			return word < pattern[w] ? -1 : 1;
+	}
+	return 0;
+}
+
+inline int CKMCFile::CompareSufix(const uchar* record_ptr, const uint64* pattern) const
+{
+	switch (sufix_words)
+	{
+	case 1:
+		return CompareSufixWords<1>(record_ptr, pattern);
+	case 2:
+		return CompareSufixWords<2>(record_ptr, pattern);
+	case 3:
+		return CompareSufixWords<3>(record_ptr, pattern);
+	default:
+		return CompareSufixWords<0>(record_ptr, pattern);
+	}
+}
+
+//------------------------------------------------------------------------------------------
+// Read the counter stored after a suffix
+// OUT: counter - the counter, 1 if the database stores none
+// RET: true    - if the counter is within [min_count, max_count]
+//------------------------------------------------------------------------------------------
+inline bool CKMCFile::ReadCounter(const uchar* record_ptr, uint64 &counter) const
+{
+	if (counter_size == 0)
+	{
+		counter = 1;
+		return true;
+	}
+	const uchar* counter_ptr = record_ptr + sufix_size;
+	counter = *counter_ptr;
+	for (uint32 b = 1; b < counter_size; b++)
+	{
+		uint64 aux = 0x000000ff & *(counter_ptr + b);
+		aux = aux << 8 * (b);
+		counter = aux | counter;
+	}
+	return (counter >= min_count) && (counter <= max_count);
+}
+
+//------------------------------------------------------------------------------------------
+// Interpolation keys: the leading min(sufix_size, 8) suffix bytes as a big-endian number
+//------------------------------------------------------------------------------------------
+inline uint64 CKMCFile::SufixKey(const uchar* record_ptr) const
+{
+	if (sufix_size >= 8)
+		return LoadSufixWord(record_ptr);
+	if (sufix_size == 0)
+		return 0;
+	return (LoadSufixWord(record_ptr) & sufix_last_mask) >> (64 - sufix_size * 8);
+}
+
+inline uint64 CKMCFile::PatternKey(const uint64* pattern) const
+{
+	if (sufix_size >= 8)
+		return pattern[0];
+	if (sufix_size == 0)
+		return 0;
+	return pattern[0] >> (64 - sufix_size * 8);
+}
+
+inline uint64 CKMCFile::MaxSufixKey() const
+{
+	return sufix_size >= 8 ? ~0ull : (1ull << (sufix_size * 8)) - 1;
+}
+
+inline int64 CKMCFile::InterpolateProbe(int64 low, int64 high, uint64 low_key, uint64 high_key, uint64 key)
+{
+	if (key <= low_key)
+		return low;
+	if (key >= high_key)
+		return high - 1;
+	double fraction = double(key - low_key) / (double(high_key - low_key) + 1.0);
+	int64 probe = low + int64(fraction * double(high - low));
+	return MIN(probe, high - 1);		//fraction < 1, so only rounding can reach high
+}
+
+//------------------------------------------------------------------------------------------
+// Look up every kmer of a batch. Kmers are aligned, sorted by bucket and then by value, and
+// each bucket is walked once from its start: every search resumes at the position of the
+// previous kmer, galloping forward before a binary search, so a bucket is scanned mostly in
+// order instead of being entered at random once per kmer. Up to lookup_lanes buckets are
+// searched in lockstep, each lane prefetching its next probe, so their cache misses overlap
+// instead of stalling one after another. With search_interpolation a lane guesses its probes
+// from the suffix value instead of galloping, and bisects once a guess fails to halve the
+// range. With a filter (see BuildFilter), kmers it rejects are dropped before sorting, and
+// its blocks are prefetched filter_distance kmers ahead. In layout_compressed the kmers are
+// looked up one by one instead (see CheckEliasFanoKmers). Counters are written back in the
+// order the kmers were added.
+// IN/OUT: batch - kmers to look up, their counters on return
+// RET   : the number of kmers that exist
+//------------------------------------------------------------------------------------------
+template<uint32 KMER_LEN> uint64 CKMCFile::CheckKmers(CKmerBatch &batch)
+{
+	static_assert(KMER_LEN <= MAX_K, "kmer length above MAX_K");
+	const uint64 n = batch.size();
+	batch.counters.assign(n, 0);
+	if (is_opened != opened_for_RA || end_of_file || n == 0)
+		return 0;
+
+	const uint32 len = KMER_LEN ? KMER_LEN : kmer_length;
+	if (len > MAX_K)
+		return 0;
+	const uchar byte_alignment = (len % 4) ? 4 - (len % 4) : 0;
+	const uint32 no_of_rows = (len + byte_alignment + 31) / 32;
+	const uint32 offset = 62 - ((len - 1 + byte_alignment) & 31) * 2;
+	if (batch.words != no_of_rows)
+		return 0;
+
+	batch.aligned.resize(n * no_of_rows);
+	batch.entries.clear();
+	for (uint64 i = 0; i < n; ++i)
+	{
+		const uint64* kmer = &batch.kmers[i * no_of_rows];
+		uint64* kmer_data = &batch.aligned[i * no_of_rows];
+		if (offset)
+		{
+			for (uint32 j = 0; j + 1 < no_of_rows; ++j)
+				kmer_data[j] = (kmer[j] << offset) + (kmer[j + 1] >> (64 - offset));
+			kmer_data[no_of_rows - 1] = kmer[no_of_rows - 1] << offset;
+		}
+		else
+		{
+			for (uint32 j = 0; j < no_of_rows; ++j)
+				kmer_data[j] = kmer[j];
+		}
+		uint64 lut_pos;
+		if (GetLutPosition<KMER_LEN>(kmer_data, byte_alignment, lut_pos))
+			batch.entries.push_back({lut_pos, kmer_data[0], i});
+	}
+
+	uint64 rejected = 0;
+	if (filter)
+	{
+		uint64 pattern[MAX_SUFIX_WORDS];
+		batch.hashes.resize(batch.entries.size());
+		for (uint64 j = 0; j < batch.entries.size(); ++j)
+		{
+			MakeSufixPattern(&batch.aligned[batch.entries[j].index * no_of_rows], byte_alignment, pattern);
+			batch.hashes[j] = FilterHash(batch.entries[j].lut_pos, pattern);
+			if (j < filter_distance)
+				my_prefetch(FilterBlock(batch.hashes[j]));
+		}
+		uint64 kept = 0;
+		for (uint64 j = 0; j < batch.entries.size(); ++j)
+		{
+			if (j + filter_distance < batch.hashes.size())
+				my_prefetch(FilterBlock(batch.hashes[j + filter_distance]));
+			if (FilterContains(batch.hashes[j]))
+				batch.entries[kept++] = batch.entries[j];
+		}
+		rejected = batch.entries.size() - kept;
+		batch.entries.resize(kept);
+	}
+
+	if (sufix_layout == layout_compressed)
+	{
+		uint64 found = CheckEliasFanoKmers(batch, no_of_rows, byte_alignment);
+		if (filter)
+			CountFilterLookups(n, found, rejected);
+		return found;
+	}
+
+	const uint64* aligned = batch.aligned.data();
+	std::sort(batch.entries.begin(), batch.entries.end(), [=](const CKmerBatch::CEntry &a, const CKmerBatch::CEntry &b)
+	{
+		if (a.lut_pos != b.lut_pos)
+			return a.lut_pos < b.lut_pos;
+		if (a.first_row != b.first_row || no_of_rows == 1)
+			return a.first_row < b.first_row;
+		return std::lexicographical_compare(aligned + a.index * no_of_rows + 1, aligned + (a.index + 1) * no_of_rows,
+											aligned + b.index * no_of_rows + 1, aligned + (b.index + 1) * no_of_rows);
+	});
+
+	//one lane per bucket run: the lane resolves the run's kmers one after another, each
+	//search resuming where the previous one landed (galloping, then bisecting). In the
+	//Eytzinger layout every search descends from the bucket's root instead
+	struct CLane
+	{
+		const CKmerBatch::CEntry* entry;
+		const CKmerBatch::CEntry* run_end;
+		uint64 pattern[MAX_SUFIX_WORDS];	// the kmer's suffix, see MakeSufixPattern
+		int64 low, high, stop, probe, step;	// step is the 1-based tree node in the Eytzinger layout
+		uint64 key, low_key, high_key;		// interpolation keys of the kmer and the bounds of [low, high)
+		bool galloping, interpolating;
+	};
+	const bool eytzinger = sufix_layout == layout_eytzinger;
+	const bool interpolation = !eytzinger && sufix_search == search_interpolation;
+	const uint64 max_key = MaxSufixKey();
+	const CKmerBatch::CEntry* next_entry = batch.entries.data();
+	const CKmerBatch::CEntry* entries_end = next_entry + batch.entries.size();
+	uint64 found = 0;
+
+	auto record = [&](int64 index) { return &sufix_file_buf[index * sufix_rec_size]; };
+	auto start_kmer = [&](CLane &lane)
+	{
+		MakeSufixPattern(aligned + lane.entry->index * no_of_rows, byte_alignment, lane.pattern);
+		lane.galloping = !eytzinger && !interpolation;
+		lane.interpolating = interpolation;
+		lane.probe = lane.low;
+		lane.step = 1;
+		if (interpolation)
+		{
+			//records from low on are not below the previous kmer of the run, whose key is lane.low_key
+			lane.high = lane.stop + 1;
+			lane.key = PatternKey(lane.pattern);
+			lane.high_key = max_key;
+			lane.probe = InterpolateProbe(lane.low, lane.high, lane.low_key, lane.high_key, lane.key);
+		}
+	};
+	//take the next bucket run; false if none is left
+	auto start_run = [&](CLane &lane)
+	{
+		while (next_entry != entries_end)
+		{
+			lane.entry = next_entry;
+			lane.run_end = next_entry;
+			while (lane.run_end != entries_end && lane.run_end->lut_pos == lane.entry->lut_pos)
+				++lane.run_end;
+			next_entry = lane.run_end;
+			lane.low = prefix_file_buf[lane.entry->lut_pos];
+			lane.stop = MIN((int64)prefix_file_buf[lane.entry->lut_pos + 1], (int64)total_kmers) - 1;
+			lane.low_key = 0;
+			if (lane.low <= lane.stop)		//kmers of an empty bucket do not exist
+			{
+				start_kmer(lane);
+				return true;
+			}
+		}
+		return false;
+	};
+	//move to the next kmer of the run, or to a new run; false if none is left
+	auto next_kmer = [&](CLane &lane)
+	{
+		//past the end of the bucket, the remaining (greater) kmers of the run do not exist
+		if (++lane.entry != lane.run_end && lane.low <= lane.stop)	//always true for Eytzinger
+		{
+			lane.low_key = lane.key;
+			start_kmer(lane);
+			return true;
+		}
+		return start_run(lane);
+	};
+
+	CLane lanes[lookup_lanes];
+	uint32 active = 0;
+	for (; active < lookup_lanes && start_run(lanes[active]); ++active)
+		my_prefetch(record(lanes[active].probe));
+
+	//each round makes one step in every lane, whose probe was prefetched in the previous round
+	while (active)
+	{
+		for (uint32 i = 0; i < active;)
+		{
+			CLane &lane = lanes[i];
+			int cmp = CompareSufix(record(lane.probe), lane.pattern);
+			if (eytzinger)
+			{
+				if (cmp != 0)
+				{
+					lane.step = 2 * lane.step + (cmp < 0);
+					if (lane.step <= lane.stop - lane.low + 1)
+					{
+						lane.probe = lane.low + lane.step - 1;
+						my_prefetch(record(lane.probe));
+						++i;
+						continue;
+					}
+				}
+				uint64 counter;
+				if (cmp == 0 && ReadCounter(record(lane.probe), counter))
+				{
+					batch.counters[lane.entry->index] = counter;
+					++found;
+				}
+				if (!next_kmer(lane))
+				{
+					lane = lanes[--active];
+					continue;
+				}
+				my_prefetch(record(lane.probe));
+				++i;
+				continue;
+			}
+			if (lane.galloping)
+			{
+				if (cmp < 0)
+				{
+					lane.low = lane.probe + 1;
+					lane.probe += lane.step;
+					lane.step <<= 1;
+					if (lane.probe <= lane.stop)
+					{
+						my_prefetch(record(lane.probe));
+						++i;
+						continue;
+					}
+					lane.high = lane.stop + 1;
+				}
+				else
+					lane.high = lane.probe;
+				lane.galloping = false;
+			}
+			else
+			{
+				int64 range = lane.high - lane.low;
+				if (cmp < 0)
+				{
+					lane.low = lane.probe + 1;
+					if (lane.interpolating)
+						lane.low_key = SufixKey(record(lane.probe));
+				}
+				else
+				{
+					lane.high = lane.probe;
+					if (lane.interpolating)
+						lane.high_key = SufixKey(record(lane.probe));
+				}
+				//a skewed bucket: fall back to bisecting
+				if (2 * (lane.high - lane.low) > range)
+					lane.interpolating = false;
+			}
+
+			if (lane.low == lane.high)
+			{
+				//lane.low is the first record not below the kmer
+				uint64 counter;
+				if (lane.low <= lane.stop && CompareSufix(record(lane.low), lane.pattern) == 0 && ReadCounter(record(lane.low), counter))
+				{
+					batch.counters[lane.entry->index] = counter;
+					++found;
+				}
+				if (!next_kmer(lane))
+				{
+					lane = lanes[--active];
+					continue;
+				}
+			}
+			else if (lane.interpolating)
+				lane.probe = InterpolateProbe(lane.low, lane.high, lane.low_key, lane.high_key, lane.key);
+			else
+				lane.probe = (lane.low + lane.high) / 2;
+			my_prefetch(record(lane.probe));
+			++i;
+		}
+	}
+	if (filter)
+		CountFilterLookups(n, found, rejected);
+	return found;
+}
+
+inline void CKMCFile::CountFilterLookups(uint64 queries, uint64 found, uint64 rejected)
+{
+	filter_queries.fetch_add(queries, std::memory_order_relaxed);
+	filter_absent.fetch_add(queries - found, std::memory_order_relaxed);
+	filter_rejected.fetch_add(rejected, std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------------------
+// Check if kmer exists
+// IN	: kmer - kmer as packed words in the CKmerAPI::to_long layout
+// RET	: true if kmer exists
+//----------------------------------------------------------------------------------------
+template<uint32 KMER_LEN> bool CKMCFile::IsKmer(const uint64* kmer)
+{
+	uint64 _count;
+	return CheckKmer<KMER_LEN>(kmer, _count);
+}
+
+//---------------------------------------------------------------------------------
+// Auxiliary function. The same as CKmerAPI::get_signature, for raw kmer_data
+//---------------------------------------------------------------------------------
+template<uint32 KMER_LEN> uint32 CKMCFile::GetSignature(const uint64* kmer_data, uchar byte_alignment) const
+{
+	const uint32 len = KMER_LEN ? KMER_LEN : kmer_length;
+	CMmer cur_mmr(signature_len);
+	for (uint32 i = 0; i < signature_len; ++i)
+	{
+		uint32 pos = i + byte_alignment;
+		cur_mmr.insert((kmer_data[pos >> 5] >> (62 - (pos & 31) * 2)) & 3);
+	}
+	CMmer min_mmr(cur_mmr);
+	for (uint32 i = signature_len; i < len; ++i)
+	{
+		uint32 pos = i + byte_alignment;
+		cur_mmr.insert((kmer_data[pos >> 5] >> (62 - (pos & 31) * 2)) & 3);
+		if (cur_mmr < min_mmr)
+			min_mmr = cur_mmr;
+	}
+	return min_mmr.get();
+}
+
 #endif
 
 // ***** EOF
@@ -35,6 +35,19 @@ protected:
 
 	friend class CKMCFile;
 	
+	//----------------------------------------------------------------------------------
+	// (Re)allocate kmer_data for a kmer of len symbols
+	inline void set_length(uint32 len)
+	{
+		if (kmer_length && kmer_data)
+			delete[] kmer_data;
+
+		kmer_length = len;
+		byte_alignment = (kmer_length % 4) ? 4 - (kmer_length % 4) : 0;
+		no_of_rows = (kmer_length + byte_alignment + 31) / 32;
+		kmer_data = kmer_length ? new uint64[no_of_rows] : NULL;
+	}
+
 	//----------------------------------------------------------------------------------
 	inline void clear()
 	{
@@ -469,6 +482,37 @@ public:
 		}
 	}
 
+	//-----------------------------------------------------------------------
+	// Set kmer from 64-bit words in the layout produced by to_long: 2-bit symbols
+	// (A=0, C=1, G=2, T=3), right-aligned, the most significant word first.
+	// No character parsing is done
+	// IN	: kmer	- ceil(len / 32) words
+	// IN	: len	- a number of symbols of a kmer
+	//-----------------------------------------------------------------------
+	inline void from_long(const uint64* kmer, uint32 len)
+	{
+		if (kmer_length != len)
+			set_length(len);
+
+		uint32 offset = 62 - ((kmer_length - 1 + byte_alignment) & 31) * 2;
+		if (offset)
+		{
+			for (uint32 i = 0; i + 1 < no_of_rows; ++i)
+				kmer_data[i] = (kmer[i] << offset) + (kmer[i + 1] >> (64 - offset));
+			kmer_data[no_of_rows - 1] = kmer[no_of_rows - 1] << offset;
+		}
+		else
+		{
+			for (uint32 i = 0; i < no_of_rows; ++i)
+				kmer_data[i] = kmer[i];
+		}
+	}
+
+	inline void from_long(const std::vector<uint64>& kmer, uint32 len)
+	{
+		from_long(kmer.data(), len);
+	}
+
 	//-----------------------------------------------------------------------
 	// Convert kmer into string (an alphabet ACGT)
 	// OUT 	: str - string kmer
@@ -675,6 +719,155 @@ public:
 };
 
 
+//-----------------------------------------------------------------------
+// A kmer with inline storage for MAX_K symbols, laid out as CKmerAPI::kmer_data
+// (byte-aligned, shifted towards MSB). It owns no heap memory and is trivially
+// copyable, so temporaries cost nothing. CKMCFile accepts it directly.
+//-----------------------------------------------------------------------
+class CKmerValue
+{
+protected:
+	uint64 kmer_data[MAX_KMER_ROWS];	// Only the first no_of_rows words are used
+	uint32 kmer_length;				// Kmer's length, in symbols
+	uchar byte_alignment;			// A number of "empty" symbols placed before prefix
+	uint32 no_of_rows;				// A number of 64-bits words used in kmer_data
+
+	friend class CKMCFile;
+
+	inline void insert2bits(uint32 pos, uchar val)
+	{
+		kmer_data[(pos + byte_alignment) >> 5] += (uint64)val << (62 - (((pos + byte_alignment) & 31) * 2));
+	}
+
+	inline uchar extract2bits(uint32 pos) const
+	{
+		return (kmer_data[(pos + byte_alignment) >> 5] >> (62 - (((pos + byte_alignment) & 31) * 2))) & 3;
+	}
+
+public:
+	//-----------------------------------------------------------------------
+	// IN	: length - a number of symbols of a kmer, at most MAX_K
+	//-----------------------------------------------------------------------
+	inline CKmerValue(uint32 length = 0)
+	{
+		set_length(length);
+	}
+
+	inline void set_length(uint32 length)
+	{
+		kmer_length = length;
+		byte_alignment = (length % 4) ? 4 - (length % 4) : 0;
+		no_of_rows = length ? (length + byte_alignment + 31) / 32 : 0;
+		clear();
+	}
+
+	inline void clear()
+	{
+		memset(kmer_data, 0, sizeof(kmer_data));
+	}
+
+	inline uint32 length() const
+	{
+		return kmer_length;
+	}
+
+	inline bool operator==(const CKmerValue &kmer) const
+	{
+		if (kmer_length != kmer.kmer_length)
+			return false;
+		for (uint32 i = 0; i < no_of_rows; ++i)
+			if (kmer_data[i] != kmer.kmer_data[i])
+				return false;
+		return true;
+	}
+
+	// If arguments differ in length a result is undefined
+	inline bool operator<(const CKmerValue &kmer) const
+	{
+		for (uint32 i = 0; i < no_of_rows; ++i)
+			if (kmer_data[i] != kmer.kmer_data[i])
+				return kmer_data[i] < kmer.kmer_data[i];
+		return false;
+	}
+
+	inline uchar get_num_symbol(uint32 pos) const
+	{
+		return extract2bits(pos);
+	}
+
+	//-----------------------------------------------------------------------
+	// Set kmer from 64-bit words in the CKmerAPI::to_long layout
+	// IN	: kmer	- ceil(len / 32) words
+	// IN	: len	- a number of symbols of a kmer
+	//-----------------------------------------------------------------------
+	inline void from_long(const uint64* kmer, uint32 len)
+	{
+		if (kmer_length != len)
+			set_length(len);
+
+		uint32 offset = 62 - ((kmer_length - 1 + byte_alignment) & 31) * 2;
+		if (offset)
+		{
+			for (uint32 i = 0; i + 1 < no_of_rows; ++i)
+				kmer_data[i] = (kmer[i] << offset) + (kmer[i + 1] >> (64 - offset));
+			kmer_data[no_of_rows - 1] = kmer[no_of_rows - 1] << offset;
+		}
+		else
+		{
+			for (uint32 i = 0; i < no_of_rows; ++i)
+				kmer_data[i] = kmer[i];
+		}
+	}
+
+	//-----------------------------------------------------------------------
+	// Convert kmer into 64-bit words in the CKmerAPI::to_long layout
+	// OUT	: kmer	- ceil(length() / 32) words, which is no_of_rows
+	//-----------------------------------------------------------------------
+	inline void to_long(uint64* kmer) const
+	{
+		uint32 offset = 62 - ((kmer_length - 1 + byte_alignment) & 31) * 2;
+		if (offset)
+		{
+			for (int32 i = no_of_rows - 1; i >= 1; --i)
+				kmer[i] = (kmer_data[i] >> offset) + (kmer_data[i - 1] << (64 - offset));
+			kmer[0] = kmer_data[0] >> offset;
+		}
+		else
+		{
+			for (uint32 i = 0; i < no_of_rows; ++i)
+				kmer[i] = kmer_data[i];
+		}
+	}
+
+	//-----------------------------------------------------------------------
+	// Convert a string of an alphabet ACGT into a kmer
+	// RET	: true - if succesfull
+	//-----------------------------------------------------------------------
+	inline bool from_string(const std::string& kmer_string)
+	{
+		if (kmer_string.size() > MAX_K)
+			return false;
+		set_length(static_cast<uint32>(kmer_string.size()));
+		for (uint32 i = 0; i < kmer_length; ++i)
+		{
+			char code = CKmerAPI::num_codes[(uchar)kmer_string[i]];
+			if (code == -1)
+				return false;
+			insert2bits(i, code);
+		}
+		return true;
+	}
+
+	inline std::string to_string() const
+	{
+		std::string str(kmer_length, 'A');
+		for (uint32 i = 0; i < kmer_length; ++i)
+			str[i] = CKmerAPI::char_codes[extract2bits(i)];
+		return str;
+	}
+};
+
+
 #endif
 
 // ***** EOF
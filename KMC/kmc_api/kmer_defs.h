@@ -17,6 +17,11 @@
 #define KMC_VER		"3.2.4"
 #define KMC_DATE	"2024-02-09"
 
+#define MAX_K			256								// the largest k supported by KMC
+#define MAX_KMER_ROWS	((MAX_K + 3 + 31) / 32)			// 64-bit words needed for a MAX_K kmer with byte alignment
+#define MAX_SUFIX_WORDS	((MAX_K / 4 + 7) / 8)			// 64-bit words needed for the longest suffix of a record
+#define SUFIX_PADDING	8								// bytes after a suffix buffer, so that whole words can be loaded from any record
+
 #ifndef MIN
 #define MIN(x,y)	((x) < (y) ? (x) : (y))
 #endif
@@ -31,6 +36,10 @@
 	#define my_fopen    fopen
 	#define my_fseek    fseek
 	#define my_ftell    ftell
+	#define my_prefetch(ptr)	__builtin_prefetch(ptr)
+	#define my_bswap64(x)		__builtin_bswap64(x)
+	#define my_popcount(x)		__builtin_popcountll(x)
+	#define my_ctz(x)			__builtin_ctzll(x)	// x != 0
 
 
 	#include <stdio.h>
@@ -41,6 +50,14 @@
 	#define my_fopen    fopen
 	#define my_fseek    _fseeki64
 	#define my_ftell    _ftelli64
+
+	#include <xmmintrin.h>
+	#define my_prefetch(ptr)	_mm_prefetch((const char*)(ptr), _MM_HINT_T0)
+	#include <stdlib.h>
+	#define my_bswap64(x)		_byteswap_uint64(x)
+	#include <intrin.h>
+	#define my_popcount(x)		__popcnt64(x)
+	#define my_ctz(x)			_tzcnt_u64(x)		// x != 0
 #endif
 	using int32 = int32_t;
 	using uint32 = uint32_t;
@@ -6,6 +6,9 @@ mkdir /project/bin
 cp /project/build/fastibs /project/bin
 cp /project/build/fastibsmapper /project/bin
 cp /project/build/KDBIntersect /project/bin
+cp /project/build/KDBLookupBench /project/bin
+cp /project/build/KDBShare /project/bin
+cp /project/build/kmc2fibs /project/bin
 
 echo "Build completed successfully."
 
@@ -25,6 +25,8 @@ std::string findPrefix(const std::string &path)
     {
         std::string filename = entry.path().filename().string();
         size_t pos = filename.find(".kmc_");
+        if (pos == std::string::npos && entry.path().extension() == FIBS_EXTENSION)
+            pos = filename.size() - strlen(FIBS_EXTENSION);
         if (pos != std::string::npos)
         {
             return filename.substr(0, pos);
@@ -45,29 +47,39 @@ int main(int argc, char *argv[])
 {
     string sourcePath, referencePath, resultsFolder, database;
     int windowSize;
+    KmerDatabaseOptions options;
+    bool validOptions = true;
+    for (int i = 5; i < argc; i++)
+        validOptions = validOptions && parseDatabaseOption(argv[i], options);
 
     // Parse command line arguments
-    if (argc != 5)
+    if (argc < 5 || !validOptions)
     {
         cout << "\nFastIBS - IBS Distance Calculator\n"
              << "----------------------------------\n"
              << "Usage:\n"
-             << "  " << argv[0] << " <sourcePath> <referencePath> <resultsFolder> <windowSize>\n\n"
+             << "  " << argv[0] << " <sourcePath> <referencePath> <resultsFolder> <windowSize> [options]\n\n"
              << "Arguments:\n"
              << "  <sourcePath>     Path to folder with KMC dataset\n"
-             << "                   e.g., /mnt/data/kmc_sets/BW_01002\n\n"
+             << "                   e.g., /mnt/data/kmc_sets/BW_01002; a FIBS index there\n"
+             << "                   (see kmc2fibs) is used instead of the KMC files\n\n"
              << "  <referencePath>  Path to folder with reference genomes (FASTA)\n"
              << "                   e.g., /mnt/data/reference\n\n"
              << "  <resultsFolder>  Path to folder for storing output results\n"
              << "                   e.g., /mnt/data/FastIBS_runs\n\n"
              << "  <windowSize>     Length of the sequence window for IBS calculation\n"
              << "                   (integer, e.g., 50000)\n\n"
-             << "Notes:\n"
+             << "Options:\n"
+             << "  --soft-mask=<mode>  How k-mers over lowercase (soft-masked) bases are counted:\n"
+             << "                      ignore (default), exclude, or separate (own columns)\n";
+        printDatabaseOptions(cout);
+        cout << "\nNotes:\n"
              << "  - All folders should be located on a mounted data volume.\n"
              << "  - Reference files can be gzip-compressed.\n\n"
              << "Output:\n"
              << "  A tab-delimited file summarizing IBS distance metrics for each window.\n"
-             << "  Columns: seqname, start, end, total_kmers, observed_kmers, variations, kmer_distance\n\n";
+             << "  Columns: seqname, start, end, total_kmers, observed_kmers, variations, kmer_distance, n_bases\n"
+             << "  With --soft-mask=separate: soft_masked_kmers, observed_soft_masked_kmers\n\n";
         return 1;
     }
     else
@@ -92,7 +104,7 @@ int main(int argc, char *argv[])
 
     auto start = chrono::high_resolution_clock::now();
     cout << "Loading KMC database from " << sourcePath << endl;
-    KmerDatabase db(sourcePath);
+    KmerDatabase db(sourcePath, false, options);
     db.printKMCInfo();
     auto end = chrono::high_resolution_clock::now();
     chrono::duration<double> elapsed = end - start;
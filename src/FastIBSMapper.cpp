@@ -13,6 +13,8 @@ std::string findPrefix(const std::string &path)
     {
         std::string filename = entry.path().filename().string();
         size_t pos = filename.find(".kmc_");
+        if (pos == std::string::npos && entry.path().extension() == FIBS_EXTENSION)
+            pos = filename.size() - strlen(FIBS_EXTENSION);
         if (pos != std::string::npos)
         {
             return filename.substr(0, pos);
@@ -32,21 +34,28 @@ void removeTrailingSlash(string &path)
 int main(int argc, char *argv[])
 {
     string sourcePath, referencePath, resultsFolder, database;
+    KmerDatabaseOptions options;
+    bool validOptions = true;
+    for (int i = 4; i < argc; i++)
+        validOptions = validOptions && parseDatabaseOption(argv[i], options);
 
-    if (argc != 4)
+    if (argc < 4 || !validOptions)
     {
         cout << "\nFastIBS - Reference Mapping Tool\n"
              << "---------------------------------\n"
              << "Usage:\n"
-             << "  " << argv[0] << " <sourcePath> <referencePath> <resultsFolder>\n\n"
+             << "  " << argv[0] << " <sourcePath> <referencePath> <resultsFolder> [options]\n\n"
              << "Arguments:\n"
              << "  <sourcePath>     Path to folder containing KMC database files\n"
-             << "                   (e.g., /mnt/data/kmc_sets/<dataset_name>)\n\n"
+             << "                   (e.g., /mnt/data/kmc_sets/<dataset_name>); a FIBS index\n"
+             << "                   there (see kmc2fibs) is used instead of the KMC files\n\n"
              << "  <referencePath>  Path to folder containing reference genomes in FASTA format\n"
              << "                   (e.g., /mnt/data/reference)\n\n"
              << "  <resultsFolder>  Destination folder for writing mapping result files\n"
              << "                   (e.g., /mnt/data/FastIBS_runs)\n\n"
-             << "Notes:\n"
+             << "Options:\n";
+        printDatabaseOptions(cout);
+        cout << "\nNotes:\n"
              << "  - All input folders should reside on a mounted data volume.\n"
              << "  - The tool scans <referencePath> for .fasta files and processes them against the KMC base.\n"
              << "  - Output filenames follow the format: <KMC_prefix>_v_<reference_stem>.txt\n"
@@ -80,7 +89,7 @@ int main(int argc, char *argv[])
 
     auto start = chrono::high_resolution_clock::now();
     cout << "Loading KMC database from " << sourcePath << endl;
-    KmerDatabase db(sourcePath);
+    KmerDatabase db(sourcePath, false, options);
     db.printKMCInfo();
     auto end = chrono::high_resolution_clock::now();
     chrono::duration<double> elapsed = end - start;
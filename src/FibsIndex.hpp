@@ -0,0 +1,485 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "KmerEncoder.hpp"
+#include "../KMC/kmc_api/kmc_file.h"
+
+#define FIBS_EXTENSION ".fibs"
+#define FIBS_VERSION 2
+#define FIBS_MAX_LEVELS 32      // hash levels tried before the remaining k-mers go to the fallback table
+#define FIBS_LEVEL_GAMMA 2.0    // bits per k-mer left in a level; more bits place more k-mers per level
+#define FIBS_PREFETCH_DISTANCE 16 // k-mers a batched lookup prefetches ahead
+
+using namespace std;
+
+// A .fibs file: this header, then four sections, each starting at a 64-byte boundary:
+//   bits     - the levels of a BBHash-style minimal perfect hash, one bit array after another
+//   ranks    - the number of set bits before every 512-bit block of bits, and the total
+//   slots    - a record per k-mer, at the k-mer's hash value: a fingerprint of fingerprintBits,
+//              or the k-mer's packed words when fingerprintBits is 0
+//   fallback - k-mers no level placed, as their packed words and their slot, sorted by words
+// The file is mapped as it is, so integers are in the byte order of the converting machine.
+struct FibsHeader
+{
+    char magic[8];              // "FIBSIDX", written last, so that an interrupted conversion is not opened
+    uint32_t version;
+    uint32_t kmerLength;
+    uint32_t words;             // 64-bit words per k-mer
+    uint32_t fingerprintBits;   // 8, 16 or 32; 0 stores whole k-mers, which makes lookups exact
+    uint32_t recordBytes;       // bytes of a slot record
+    uint32_t levels;
+    uint32_t minCount;          // k-mers of the KMC database counted below this were left out
+    uint32_t reserved;
+    uint64_t kmerCount;
+    uint64_t fallbackCount;
+    uint64_t sourceSize, sourceMtime; // of the converted *.kmc_suf, to notice a database rewritten since; 0 if unknown
+    uint64_t levelStart[FIBS_MAX_LEVELS + 1]; // first bit of every level; levelStart[levels] is the total
+    uint64_t bitsOffset, ranksOffset, slotsOffset, fallbackOffset, fileSize;
+};
+
+inline constexpr char FIBS_MAGIC[8] = "FIBSIDX";
+
+// Size and modification time of the *.kmc_suf of the KMC database at kmcPath (without extension),
+// as FibsHeader records them; false if the file cannot be read
+inline bool fibsSourceStamp(const string &kmcPath, uint64_t &size, uint64_t &mtime)
+{
+    struct stat st;
+    if (stat((kmcPath + ".kmc_suf").c_str(), &st) != 0)
+        return false;
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+// Whether an index was made from the KMC database at kmcPath as it is now. Indexes that do not
+// know their source, and databases whose files are not there, are taken to match
+inline bool fibsSourceMatches(const FibsHeader &header, const string &kmcPath)
+{
+    uint64_t size, mtime;
+    if ((!header.sourceSize && !header.sourceMtime) || !fibsSourceStamp(kmcPath, size, mtime))
+        return true;
+    return header.sourceSize == size && header.sourceMtime == mtime;
+}
+
+// MurmurHash3 finalizer
+inline uint64_t fibsMix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Hash of a k-mer in the CKmerAPI::to_long layout. N fixes the number of words, 0 reads it from words
+template <uint N = 0>
+inline uint64_t fibsKmerHash(const uint64_t *kmer, uint words)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull;
+    for (uint i = 0; i < (N ? N : words); i++)
+        h = fibsMix(h ^ kmer[i]);
+    return h;
+}
+
+// A perfect-hash k-mer index in a .fibs file (see FibsHeader), made from a KMC database by
+// kmc2fibs. The file is mapped read-only, so opening takes no longer than reading the header,
+// and jobs on one node share its pages. A present k-mer costs a bit of the first level that
+// holds it, its rank and its slot record; an absent k-mer is rejected by the fingerprint in
+// the slot, wrongly with probability 2^-fingerprintBits, or never when whole k-mers are stored.
+class FibsIndex
+{
+public:
+    FibsIndex() = default;
+    FibsIndex(const FibsIndex &) = delete;
+    FibsIndex &operator=(const FibsIndex &) = delete;
+
+    ~FibsIndex()
+    {
+        close();
+    }
+
+    // Map a .fibs file. loadFlags takes load_populate, load_random and load_hugepage of CKMCFile::load_flags
+    bool open(const string &path, uint32_t loadFlags = 0)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        FibsHeader header;
+        if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+            memcmp(header.magic, FIBS_MAGIC, sizeof(FIBS_MAGIC)) != 0 || header.version != FIBS_VERSION ||
+            header.fileSize != uint64_t(st.st_size))
+        {
+            ::close(fd);
+            return false;
+        }
+        int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        if (loadFlags & CKMCFile::load_populate)
+            flags |= MAP_POPULATE;
+#endif
+        void *area = mmap(nullptr, header.fileSize, PROT_READ, flags, fd, 0);
+        ::close(fd);
+        if (area == MAP_FAILED)
+            return false;
+        if (loadFlags & CKMCFile::load_random)
+            madvise(area, header.fileSize, MADV_RANDOM);
+#ifdef MADV_HUGEPAGE
+        if (loadFlags & CKMCFile::load_hugepage)
+            madvise(area, header.fileSize, MADV_HUGEPAGE);
+#endif
+        map = (uint8_t *)area;
+        mapSize = header.fileSize;
+        attach(map);
+        return true;
+    }
+
+    void close()
+    {
+        if (map)
+            munmap(map, mapSize);
+        map = nullptr;
+        mapSize = 0;
+    }
+
+    bool isOpen() const
+    {
+        return map != nullptr;
+    }
+
+    const FibsHeader &info() const
+    {
+        return header;
+    }
+
+    // Whether the file stores whole k-mers, so that lookups are exact and the k-mers can be listed
+    bool isExact() const
+    {
+        return header.fingerprintBits == 0;
+    }
+
+    // Read only the header of a .fibs file; false if it is not a complete index
+    static bool readHeader(const string &path, FibsHeader &header)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, FIBS_MAGIC, sizeof(FIBS_MAGIC)) == 0 &&
+                  header.version == FIBS_VERSION;
+        fclose(file);
+        return ok;
+    }
+
+    template <uint N = 0>
+    bool contains(const uint64_t *kmer) const
+    {
+        uint64_t hash = fibsKmerHash<N>(kmer, header.words);
+        uint64_t slot;
+        if (placedSlot(hash, slot))
+            return slotMatches(slot, hash, kmer);
+        return inFallback(kmer);
+    }
+
+    // Look up count k-mers stored one after another. Every step runs over the whole batch with
+    // its memory accesses prefetched FIBS_PREFETCH_DISTANCE k-mers ahead: hashing, then the first
+    // level's bit and rank, then the slot record. scratch is reused between calls.
+    template <uint N = 0>
+    void checkKmers(const uint64_t *kmers, size_t count, vector<uint64_t> &scratch, vector<uint8_t> &found) const
+    {
+        const uint words = N ? N : header.words;
+        scratch.resize(2 * count);
+        uint64_t *hashes = scratch.data(), *slots = hashes + count;
+        found.assign(count, 0);
+        for (size_t i = 0; i < count; i++)
+            hashes[i] = fibsKmerHash<N>(kmers + i * words, words);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (i + FIBS_PREFETCH_DISTANCE < count)
+            {
+                uint64_t position = levelPosition(hashes[i + FIBS_PREFETCH_DISTANCE], 0);
+                __builtin_prefetch(&bits[position / 64]);
+                __builtin_prefetch(&ranks[position / 512]);
+            }
+            if (!placedSlot(hashes[i], slots[i]))
+                slots[i] = NO_SLOT;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            if (i + FIBS_PREFETCH_DISTANCE < count && slots[i + FIBS_PREFETCH_DISTANCE] != NO_SLOT)
+                __builtin_prefetch(slotRecord(slots[i + FIBS_PREFETCH_DISTANCE]));
+            const uint64_t *kmer = kmers + i * words;
+            found[i] = slots[i] != NO_SLOT ? slotMatches(slots[i], hashes[i], kmer) : inFallback(kmer);
+        }
+    }
+
+    // Copy the k-mer of a slot, in slot order; only for exact indexes
+    void kmerAt(uint64_t slot, uint64_t *kmer) const
+    {
+        memcpy(kmer, slotRecord(slot), header.recordBytes);
+    }
+
+    // Point the index at a mapped file, whose header may still lack the magic
+    void attach(const uint8_t *base)
+    {
+        memcpy(&header, base, sizeof(header));
+        bits = (const uint64_t *)(base + header.bitsOffset);
+        ranks = (const uint64_t *)(base + header.ranksOffset);
+        slots = base + header.slotsOffset;
+        fallback = (const uint64_t *)(base + header.fallbackOffset);
+    }
+
+    // Slot of a hash in the first level whose bit is set; false if no level placed it
+    bool placedSlot(uint64_t hash, uint64_t &slot) const
+    {
+        for (uint32_t level = 0; level < header.levels; level++)
+        {
+            uint64_t position = levelPosition(hash, level);
+            if ((bits[position / 64] >> (position % 64)) & 1)
+            {
+                slot = rank(position);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint64_t levelPosition(uint64_t hash, uint32_t level) const
+    {
+        uint64_t size = header.levelStart[level + 1] - header.levelStart[level];
+        return header.levelStart[level] + uint64_t((unsigned __int128)levelHash(hash, level) * size >> 64);
+    }
+
+    static uint64_t levelHash(uint64_t hash, uint32_t level)
+    {
+        return fibsMix(hash ^ (level + 1) * 0x9e3779b97f4a7c15ull);
+    }
+
+    uint32_t fingerprint(uint64_t hash) const
+    {
+        return uint32_t(hash >> (64 - header.fingerprintBits));
+    }
+
+    const uint8_t *slotRecord(uint64_t slot) const
+    {
+        return slots + slot * header.recordBytes;
+    }
+
+private:
+    static constexpr uint64_t NO_SLOT = ~0ull;
+
+    // Set bits before position: the block's count plus the words of the block before it
+    uint64_t rank(uint64_t position) const
+    {
+        uint64_t result = ranks[position / 512];
+        for (uint64_t w = position / 512 * 8; w < position / 64; w++)
+            result += __builtin_popcountll(bits[w]);
+        return result + __builtin_popcountll(bits[position / 64] & ((1ull << (position % 64)) - 1));
+    }
+
+    bool slotMatches(uint64_t slot, uint64_t hash, const uint64_t *kmer) const
+    {
+        const uint8_t *record = slotRecord(slot);
+        if (header.fingerprintBits == 0)
+            return memcmp(record, kmer, header.recordBytes) == 0;
+        uint32_t stored = 0;
+        memcpy(&stored, record, header.recordBytes);
+        return stored == fingerprint(hash);
+    }
+
+    bool inFallback(const uint64_t *kmer) const
+    {
+        const uint64_t stride = header.words + 1;
+        uint64_t low = 0, high = header.fallbackCount;
+        while (low < high)
+        {
+            uint64_t middle = (low + high) / 2;
+            const uint64_t *entry = fallback + middle * stride;
+            if (lexicographical_compare(entry, entry + header.words, kmer, kmer + header.words))
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low < header.fallbackCount && equal(kmer, kmer + header.words, fallback + low * stride);
+    }
+
+    FibsHeader header{};
+    uint8_t *map = nullptr;
+    uint64_t mapSize = 0;
+    const uint64_t *bits = nullptr, *ranks = nullptr, *fallback = nullptr;
+    const uint8_t *slots = nullptr;
+};
+
+// Run body(begin, end) over [0, count) split into one range per thread
+template <typename F>
+void fibsParallelFor(uint64_t count, uint32_t threads, F &&body)
+{
+    threads = uint32_t(max<uint64_t>(1, min<uint64_t>(threads, count / 65536 + 1)));
+    vector<std::thread> workers;
+    for (uint32_t t = 1; t < threads; t++)
+        workers.emplace_back(body, count * t / threads, count * (t + 1) / threads);
+    body(0, count / threads);
+    for (auto &worker : workers)
+        worker.join();
+}
+
+// Write a .fibs index to path, made from the KMC database at sourcePath (without extension).
+// hashes holds fibsKmerHash of every k-mer, in any order, and is consumed. forEachKmer(add) must call add(const uint64_t *kmer) once for each of the same
+// k-mers, in any order; it is run once, after the hash levels are built. The file is written
+// under a temporary name and renamed when complete.
+// RET: an empty string if successful, the error otherwise
+template <typename F>
+string writeFibsIndex(const string &path, const string &sourcePath, uint32_t kmerLength, uint32_t fingerprintBits, uint32_t minCount,
+                      vector<uint64_t> &hashes, uint32_t threads, F &&forEachKmer)
+{
+    const uint64_t kmerCount = hashes.size();
+    FibsHeader header{};
+    header.version = FIBS_VERSION;
+    header.kmerLength = kmerLength;
+    header.words = kmerWords(kmerLength);
+    header.fingerprintBits = fingerprintBits;
+    header.recordBytes = fingerprintBits ? fingerprintBits / 8 : header.words * sizeof(uint64_t);
+    header.minCount = minCount;
+    header.kmerCount = kmerCount;
+    fibsSourceStamp(sourcePath, header.sourceSize, header.sourceMtime);
+
+    // Every level sets the bits of the hashes that fall alone on their position; the rest
+    // move on to the next level
+    vector<uint64_t> bits;
+    while (!hashes.empty() && header.levels < FIBS_MAX_LEVELS)
+    {
+        uint32_t level = header.levels;
+        uint64_t size = (uint64_t(hashes.size() * FIBS_LEVEL_GAMMA) + 64) / 64 * 64;
+        header.levelStart[level + 1] = header.levelStart[level] + size;
+        vector<uint64_t> seen(size / 64), collided(size / 64);
+        fibsParallelFor(hashes.size(), threads, [&](uint64_t begin, uint64_t end)
+                        {
+                            for (uint64_t i = begin; i < end; i++)
+                            {
+                                uint64_t position = uint64_t((unsigned __int128)FibsIndex::levelHash(hashes[i], level) * size >> 64);
+                                uint64_t bit = 1ull << (position % 64);
+                                if (atomic_ref<uint64_t>(seen[position / 64]).fetch_or(bit, memory_order_relaxed) & bit)
+                                    atomic_ref<uint64_t>(collided[position / 64]).fetch_or(bit, memory_order_relaxed);
+                            } });
+        for (uint64_t w = 0; w < size / 64; w++)
+            bits.push_back(seen[w] & ~collided[w]);
+        uint64_t kept = 0;
+        for (uint64_t hash : hashes)
+        {
+            uint64_t position = uint64_t((unsigned __int128)FibsIndex::levelHash(hash, level) * size >> 64);
+            if ((collided[position / 64] >> (position % 64)) & 1)
+                hashes[kept++] = hash;
+        }
+        hashes.resize(kept);
+        header.levels++;
+    }
+    header.fallbackCount = hashes.size();
+    hashes = vector<uint64_t>();
+
+    uint64_t blocks = (bits.size() + 7) / 8;
+    vector<uint64_t> ranks(blocks + 1);
+    for (uint64_t b = 0; b < blocks; b++)
+    {
+        uint64_t count = 0;
+        for (uint64_t w = b * 8; w < min<uint64_t>(b * 8 + 8, bits.size()); w++)
+            count += __builtin_popcountll(bits[w]);
+        ranks[b + 1] = ranks[b] + count;
+    }
+    const uint64_t placed = ranks[blocks];
+
+    auto align = [](uint64_t offset)
+    { return (offset + 63) / 64 * 64; };
+    header.bitsOffset = align(sizeof(FibsHeader));
+    header.ranksOffset = align(header.bitsOffset + bits.size() * sizeof(uint64_t));
+    header.slotsOffset = align(header.ranksOffset + ranks.size() * sizeof(uint64_t));
+    header.fallbackOffset = align(header.slotsOffset + kmerCount * header.recordBytes);
+    header.fileSize = header.fallbackOffset + header.fallbackCount * (header.words + 1) * sizeof(uint64_t);
+
+    string tempPath = path + ".tmp";
+    int fd = ::open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return "Could not create " + tempPath;
+    void *area = ftruncate(fd, header.fileSize) == 0 ? mmap(nullptr, header.fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (area == MAP_FAILED)
+    {
+        remove(tempPath.c_str());
+        return "Could not write " + tempPath;
+    }
+    uint8_t *base = (uint8_t *)area;
+    memcpy(base, &header, sizeof(header));
+    memcpy(base + header.bitsOffset, bits.data(), bits.size() * sizeof(uint64_t));
+    memcpy(base + header.ranksOffset, ranks.data(), ranks.size() * sizeof(uint64_t));
+    bits = vector<uint64_t>();
+
+    // Fill the slots through the levels just written; k-mers no level placed take the slots
+    // after the placed ones, in the order of their words
+    FibsIndex index;
+    index.attach(base);
+    uint64_t added = 0;
+    vector<uint64_t> unplaced;
+    auto writeSlot = [&](uint64_t slot, uint64_t hash, const uint64_t *kmer)
+    {
+        uint8_t *record = base + header.slotsOffset + slot * header.recordBytes;
+        if (fingerprintBits)
+        {
+            uint32_t stored = index.fingerprint(hash);
+            memcpy(record, &stored, header.recordBytes);
+        }
+        else
+            memcpy(record, kmer, header.recordBytes);
+    };
+    forEachKmer([&](const uint64_t *kmer)
+                {
+                    added++;
+                    uint64_t hash = fibsKmerHash(kmer, header.words), slot;
+                    if (index.placedSlot(hash, slot) && slot < placed)
+                        writeSlot(slot, hash, kmer);
+                    else
+                        unplaced.insert(unplaced.end(), kmer, kmer + header.words); });
+
+    string error;
+    if (added != kmerCount || unplaced.size() != header.fallbackCount * header.words)
+        error = "The k-mers changed between the passes over the database";
+    else
+    {
+        vector<uint64_t> order(header.fallbackCount);
+        for (uint64_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        const uint words = header.words;
+        sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b)
+             { return lexicographical_compare(&unplaced[a * words], &unplaced[(a + 1) * words],
+                                              &unplaced[b * words], &unplaced[(b + 1) * words]); });
+        uint64_t *entry = (uint64_t *)(base + header.fallbackOffset);
+        for (uint64_t i = 0; i < order.size(); i++, entry += words + 1)
+        {
+            const uint64_t *kmer = &unplaced[order[i] * words];
+            memcpy(entry, kmer, words * sizeof(uint64_t));
+            entry[words] = placed + i;
+            writeSlot(placed + i, fibsKmerHash(kmer, words), kmer);
+        }
+        memcpy(base, FIBS_MAGIC, sizeof(FIBS_MAGIC));
+        if (msync(base, header.fileSize, MS_SYNC) != 0)
+            error = "Could not write " + tempPath;
+    }
+    munmap(base, header.fileSize);
+    if (error.empty() && rename(tempPath.c_str(), path.c_str()) != 0)
+        error = "Could not rename " + tempPath + " to " + path;
+    if (!error.empty())
+        remove(tempPath.c_str());
+    return error;
+}
@@ -12,6 +12,8 @@ string findPrefix(const string &path)
     {
         string filename = entry.path().filename().string();
         size_t pos = filename.find(".kmc_");
+        if (pos == string::npos && entry.path().extension() == FIBS_EXTENSION)
+            pos = filename.size() - strlen(FIBS_EXTENSION);
         if (pos != string::npos)
         {
             return filename.substr(0, pos);
@@ -28,10 +30,25 @@ void removeTrailingSlash(string &path)
     }
 }
 
+// Size that decides which database is listed: the KMC prefix file, or the FIBS index without it
+uint64_t databaseSize(const string &path)
+{
+    if (fs::exists(path + ".kmc_pre"))
+        return fs::file_size(path + ".kmc_pre") / 1024 / 1024;
+    return fs::file_size(path + FIBS_EXTENSION) / 1024 / 1024;
+}
+
+// A FIBS index of fingerprints cannot be listed, only looked up
+bool canList(const string &path)
+{
+    FibsHeader header;
+    return fs::exists(path + ".kmc_pre") || (FibsIndex::readHeader(path + FIBS_EXTENSION, header) && header.fingerprintBits == 0);
+}
+
 uint getIntersectionSize(KmerDatabase &db1, KmerDatabase &db2)
 {
     uint intersectionSize = 0;
-    CKmerAPI kmer(db1.getKmerSize());
+    CKmerValue kmer(db1.getKmerSize());
     while (db1.readNextKmer(kmer))
         if (db2.isKmer(kmer))        
             intersectionSize += 1; 
@@ -60,7 +77,9 @@ int main(int argc, char *argv[])
              << "  - The tool compares the two KMC databases, choosing the smaller database\n"
              << "    for random access to optimize performance.\n"
              << "  - The intersection size is output as an integer, which represents the\n"
-             << "    number of common k-mers between the two databases.\n\n"
+             << "    number of common k-mers between the two databases.\n"
+             << "  - A database directory may hold a FIBS index made by kmc2fibs instead of\n"
+             << "    the KMC files; one of the two must be KMC or an exact index, to be listed.\n\n"
              << "Example:\n"
              << "  " << argv[0] << " /mnt/data/kmc_sets/db1 /mnt/data/kmc_sets/db2\n\n";
         return 1;
@@ -78,10 +97,10 @@ int main(int argc, char *argv[])
     kDB1Path += "/" + findPrefix(kDB1Path);
     kDB2Path += "/" + findPrefix(kDB2Path);
 
-    uint64_t size1 = fs::file_size(kDB1Path + ".kmc_pre") / 1024 / 1024;
-    uint64_t size2 = fs::file_size(kDB2Path + ".kmc_pre") / 1024 / 1024;
-
-    if (size1 > size2)
+    bool listSecond = databaseSize(kDB1Path) > databaseSize(kDB2Path);
+    if (!canList(listSecond ? kDB2Path : kDB1Path))
+        listSecond = !listSecond;
+    if (listSecond)
         swap(kDB1Path, kDB2Path);
 
     KmerDatabase db1(kDB1Path, true); // open for listing
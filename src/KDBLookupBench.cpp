@@ -0,0 +1,174 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <charconv>
+#include "../KMC/kmc_api/kmc_file.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+string findPrefix(const string &path)
+{
+    for (const auto &entry : filesystem::directory_iterator(path))
+    {
+        string filename = entry.path().filename().string();
+        size_t pos = filename.find(".kmc_");
+        if (pos != string::npos)
+        {
+            return filename.substr(0, pos);
+        }
+    }
+    return "";
+}
+
+void removeTrailingSlash(string &path)
+{
+    if (!path.empty() && path.back() == '/')
+    {
+        path.pop_back();
+    }
+}
+
+// Present k-mers spread evenly over the database, each followed by a copy with its last
+// base changed (mostly absent), shuffled so that consecutive lookups hit unrelated buckets
+vector<CKmerValue> sampleQueries(const string &path, size_t sampleSize)
+{
+    CKMCFile db;
+    if (!db.OpenForListing(path))
+    {
+        cerr << "Error: Could not open KMC database\n";
+        exit(1);
+    }
+    CKMCFileInfo info;
+    db.Info(info);
+    uint64 stride = max<uint64>(1, info.total_kmers / sampleSize);
+
+    vector<CKmerValue> queries;
+    CKmerValue kmer(info.kmer_length);
+    uint64 counter, words[MAX_KMER_ROWS];
+    for (uint64 i = 0; db.ReadNextKmer(kmer, counter) && queries.size() < 2 * sampleSize; ++i)
+    {
+        if (i % stride)
+            continue;
+        queries.push_back(kmer);
+        kmer.to_long(words);
+        words[(info.kmer_length - 1) / 32] ^= 1;
+        CKmerValue mutated;
+        mutated.from_long(words, info.kmer_length);
+        queries.push_back(mutated);
+    }
+    db.Close();
+
+    shuffle(queries.begin(), queries.end(), mt19937_64(42));
+    return queries;
+}
+
+void printRate(const string &label, size_t lookups, uint64 found, chrono::steady_clock::time_point start)
+{
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "  " << label << ": " << size_t(lookups / seconds) << " lookups/s, " << 1e9 * seconds / lookups << " ns/lookup ("
+         << found << " found, " << seconds << "s)\n";
+}
+
+// Time single and batched lookups of the queries against one in-memory arrangement
+void benchmark(const string &path, const string &label, CKMCFile::suffix_layout layout, CKMCFile::search_mode search, const vector<CKmerValue> &queries, uint32 filterBits = 0)
+{
+    CKMCFile db;
+    db.SetSearchMode(search);
+    if (!db.OpenForRA(path, layout))
+    {
+        cerr << "Error: Could not open KMC database\n";
+        exit(1);
+    }
+    db.BuildFilter(filterBits);
+    CKMCSufixStats sufixes = db.GetSufixStats();
+    cout << label << '\n'
+         << "  memory : " << sufixes.bytes / 1e6 << " MB of suffix records and " << (layout == CKMCFile::layout_compressed ? "select samples" : "LUT");
+    if (sufixes.bytes != sufixes.plain_bytes)
+        cout << " (" << double(sufixes.plain_bytes) / max<uint64>(sufixes.bytes, 1) << "x smaller than sorted)";
+    cout << '\n';
+
+    auto start = chrono::steady_clock::now();
+    uint64 found = 0, counter;
+    for (const auto &kmer : queries)
+        found += db.CheckKmer(kmer, counter);
+    printRate("single ", queries.size(), found, start);
+
+    uint32 kmerSize = queries.front().length();
+    uint64 words[MAX_KMER_ROWS];
+    CKmerBatch batch;
+    start = chrono::steady_clock::now();
+    batch.reset((kmerSize + 31) / 32);
+    for (const auto &kmer : queries)
+    {
+        kmer.to_long(words);
+        batch.add(words);
+    }
+    found = db.CheckKmers(batch);
+    printRate("batched", queries.size(), found, start);
+    if (filterBits)
+    {
+        CKMCFilterStats filter = db.GetFilterStats();
+        cout << "  filter : " << filter.bytes / 1e6 << " MB, rejected " << 100.0 * filter.rejected / max<uint64>(filter.absent, 1)
+             << "% of absent k-mers\n";
+    }
+    db.Close();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3)
+    {
+        cout << "\nK-mer Database Lookup Benchmark\n"
+             << "-------------------------------\n"
+             << "Usage:\n"
+             << "  " << argv[0] << " <kDBPath> [sampleSize]\n\n"
+             << "Arguments:\n"
+             << "  <kDBPath>      Path to a KMC database directory\n"
+             << "                 (e.g., /mnt/data/kmc_sets/db1)\n\n"
+             << "  [sampleSize]   Number of present k-mers to sample (default 1000000);\n"
+             << "                 as many mutated, mostly absent k-mers are added\n\n"
+             << "Description:\n"
+             << "  Times random lookups against the database for every suffix layout and\n"
+             << "  bucket search, and with a Bloom filter in front, one k-mer at a time and\n"
+             << "  as a single batch, next to the memory each layout keeps its suffixes in.\n\n";
+        return 1;
+    }
+
+    string kDBPath = argv[1];
+    size_t sampleSize = 1000000;
+    if (argc == 3)
+    {
+        string value = argv[2];
+        auto [end, error] = from_chars(value.data(), value.data() + value.size(), sampleSize);
+        if (error != errc() || end != value.data() + value.size())
+        {
+            cerr << "Error: Invalid value in sampleSize " << value << endl;
+            return 1;
+        }
+    }
+    removeTrailingSlash(kDBPath);
+    kDBPath += "/" + findPrefix(kDBPath);
+
+    auto queries = sampleQueries(kDBPath, max<size_t>(1, sampleSize));
+    if (queries.empty())
+    {
+        cout << "Error: The database is empty" << endl;
+        return 1;
+    }
+    cout << "Queries: " << queries.size() << '\n';
+
+    benchmark(kDBPath, "sorted, binary search", CKMCFile::layout_sorted, CKMCFile::search_binary, queries);
+    benchmark(kDBPath, "sorted, interpolation search", CKMCFile::layout_sorted, CKMCFile::search_interpolation, queries);
+    benchmark(kDBPath, "eytzinger", CKMCFile::layout_eytzinger, CKMCFile::search_binary, queries);
+    benchmark(kDBPath, "compressed (Elias-Fano)", CKMCFile::layout_compressed, CKMCFile::search_binary, queries);
+    benchmark(kDBPath, "sorted, binary search, 10-bit filter", CKMCFile::layout_sorted, CKMCFile::search_binary, queries, 10);
+    benchmark(kDBPath, "eytzinger, 10-bit filter", CKMCFile::layout_eytzinger, CKMCFile::search_binary, queries, 10);
+    benchmark(kDBPath, "compressed (Elias-Fano), 10-bit filter", CKMCFile::layout_compressed, CKMCFile::search_binary, queries, 10);
+
+    return 0;
+}
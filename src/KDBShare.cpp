@@ -0,0 +1,142 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <filesystem>
+#include <charconv>
+#include "../KMC/kmc_api/kmc_file.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+string findPrefix(const string &path)
+{
+    for (const auto &entry : filesystem::directory_iterator(path))
+    {
+        string filename = entry.path().filename().string();
+        size_t pos = filename.find(".kmc_");
+        if (pos != string::npos)
+        {
+            return filename.substr(0, pos);
+        }
+    }
+    return "";
+}
+
+void removeTrailingSlash(string &path)
+{
+    if (!path.empty() && path.back() == '/')
+    {
+        path.pop_back();
+    }
+}
+
+void printUsage(const char *program)
+{
+    cout << "\nK-mer Database Shared Memory Loader\n"
+         << "-----------------------------------\n"
+         << "Usage:\n"
+         << "  " << program << " load <kDBPath> <segment> [options]\n"
+         << "  " << program << " unload <segment>\n\n"
+         << "Arguments:\n"
+         << "  <kDBPath>     Path to a KMC database directory\n"
+         << "                (e.g., /mnt/data/kmc_sets/db1)\n\n"
+         << "  <segment>     POSIX shared memory name (e.g., /db1), or a file on a mounted\n"
+         << "                file system such as hugetlbfs (e.g., /dev/hugepages/db1)\n\n"
+         << "Options:\n"
+         << "  --layout=<layout>   Order of suffix records in the segment: sorted (default),\n"
+         << "                      or eytzinger\n"
+         << "  --counters=<mode>   keep (default), or drop them to make the segment smaller\n"
+         << "  --min-count=<n>     With --counters=drop (required), leave out k-mers counted\n"
+         << "                      fewer than <n> times; a segment keeping counters is\n"
+         << "                      filtered by the --min-count of each job instead\n\n"
+         << "Description:\n"
+         << "  Loads the database once into a segment that stays in memory after the tool\n"
+         << "  exits. fastibs and fastibsmapper given --shm=<segment> attach to it read-only\n"
+         << "  instead of loading the database themselves, and fall back to loading it if\n"
+         << "  the segment is missing, was made from another database, or does not match\n"
+         << "  their --counters and --min-count (see above).\n\n"
+         << "Example:\n"
+         << "  " << program << " load /mnt/data/kmc_sets/db1 /db1\n"
+         << "  fastibs /mnt/data/kmc_sets/db1 ... --shm=/db1\n"
+         << "  " << program << " unload /db1\n\n";
+}
+
+int main(int argc, char *argv[])
+{
+    string command = argc > 1 ? argv[1] : "";
+    if (command == "unload" && argc == 3)
+    {
+        if (!CKMCFile::RemoveSharedMemory(argv[2]))
+        {
+            cerr << "Error: Could not remove segment " << argv[2] << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (command != "load" || argc < 4)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    CKMCFile::suffix_layout layout = CKMCFile::layout_sorted;
+    // Map rather than read the suffix file, so that it is not held twice while copying
+    uint32 loadFlags = CKMCFile::load_mmap;
+    uint32 minCount = 0;
+    bool minCountGiven = false;
+    for (int i = 4; i < argc; i++)
+    {
+        string option = argv[i];
+        if (option == "--layout=sorted" || option == "--layout=eytzinger")
+            layout = option == "--layout=sorted" ? CKMCFile::layout_sorted : CKMCFile::layout_eytzinger;
+        else if (option == "--counters=keep" || option == "--counters=drop")
+            loadFlags = option == "--counters=keep" ? CKMCFile::load_mmap : CKMCFile::load_presence_only;
+        else if (option.rfind("--min-count=", 0) == 0)
+        {
+            string value = option.substr(12);
+            auto [end, error] = from_chars(value.data(), value.data() + value.size(), minCount);
+            if (error != errc() || end != value.data() + value.size())
+            {
+                cerr << "Error: Invalid value in " << option << endl;
+                return 1;
+            }
+            minCountGiven = true;
+        }
+        else
+        {
+            cerr << "Error: Unknown option " << option << endl;
+            return 1;
+        }
+    }
+
+    // with counters, every k-mer goes into the segment and each job applies its own --min-count
+    if (minCountGiven && !(loadFlags & CKMCFile::load_presence_only))
+    {
+        cerr << "Error: --min-count requires --counters=drop" << endl;
+        return 1;
+    }
+
+    string kDBPath = argv[2], segment = argv[3];
+    removeTrailingSlash(kDBPath);
+    kDBPath += "/" + findPrefix(kDBPath);
+
+    auto start = chrono::steady_clock::now();
+    CKMCFile db;
+    db.SetLoadFlags(loadFlags);
+    db.SetLoadMinCount(minCount);
+    db.SetLoadThreads(thread::hardware_concurrency());
+    if (!db.OpenForRA(kDBPath, layout))
+    {
+        cerr << "Error: Could not open KMC database" << endl;
+        return 1;
+    }
+    if (!db.SaveToSharedMemory(segment, kDBPath))
+    {
+        cerr << "Error: Could not create segment " << segment << " (it may already exist)" << endl;
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Loaded " << kDBPath << " into " << segment << " in " << seconds << "s" << endl;
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <filesystem>
+#include <charconv>
+#include "FibsIndex.hpp"
+
+using namespace std;
+namespace fs = filesystem;
+
+string findPrefix(const string &path)
+{
+    for (const auto &entry : filesystem::directory_iterator(path))
+    {
+        string filename = entry.path().filename().string();
+        size_t pos = filename.find(".kmc_");
+        if (pos != string::npos)
+        {
+            return filename.substr(0, pos);
+        }
+    }
+    return "";
+}
+
+void removeTrailingSlash(string &path)
+{
+    if (!path.empty() && path.back() == '/')
+    {
+        path.pop_back();
+    }
+}
+
+// Parse the value of --name=<n> as a whole unsigned number
+bool parseValue(const string &option, uint32_t &value)
+{
+    const char *first = option.data() + option.find('=') + 1, *last = option.data() + option.size();
+    auto [end, error] = from_chars(first, last, value);
+    return error == errc() && end == last && first != last;
+}
+
+void printUsage(const char *program)
+{
+    cout << "\nKMC to FIBS Index Converter\n"
+         << "---------------------------\n"
+         << "Usage:\n"
+         << "  " << program << " <kDBPath> [options]\n\n"
+         << "Arguments:\n"
+         << "  <kDBPath>     Path to a KMC database directory\n"
+         << "                (e.g., /mnt/data/kmc_sets/db1)\n\n"
+         << "Options:\n"
+         << "  --out=<file>          Index to write (default: <kDBPath>/<prefix>.fibs, next to\n"
+         << "                        the KMC files)\n"
+         << "  --fingerprint=<bits>  Bits stored per k-mer to reject absent ones: 8, 16\n"
+         << "                        (default), 32, or exact (store whole k-mers)\n"
+         << "  --min-count=<n>       Leave out k-mers counted fewer than <n> times\n"
+         << "  --threads=<n>         Threads building the hash (default: all cores)\n\n"
+         << "Description:\n"
+         << "  Builds a minimal perfect hash over the k-mers of the database and writes it\n"
+         << "  with a fingerprint (or the k-mer) per k-mer. A lookup then reads a few cache\n"
+         << "  lines, and the file is mapped rather than read, so it opens at once.\n"
+         << "  fastibs, fastibsmapper and KDBIntersect use the index instead of the KMC\n"
+         << "  files when it is in the database directory, until the KMC files change. With\n"
+         << "  fingerprints, an absent k-mer is reported present with probability 2^-bits\n"
+         << "  (about 1 in 65536 for 16). Give the tools the same --min-count.\n\n"
+         << "Example:\n"
+         << "  " << program << " /mnt/data/kmc_sets/db1\n\n";
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    string kDBPath = argv[1], outPath;
+    uint32_t fingerprintBits = 16, minCount = 0, threads = thread::hardware_concurrency();
+    for (int i = 2; i < argc; i++)
+    {
+        string option = argv[i];
+        if (option.rfind("--out=", 0) == 0)
+            outPath = option.substr(6);
+        else if (option == "--fingerprint=exact")
+            fingerprintBits = 0;
+        else if (option.rfind("--fingerprint=", 0) == 0)
+        {
+            if (!parseValue(option, fingerprintBits) || (fingerprintBits != 8 && fingerprintBits != 16 && fingerprintBits != 32))
+            {
+                cerr << "Error: Invalid value in " << option << " (8, 16, 32 or exact)" << endl;
+                return 1;
+            }
+        }
+        else if (option.rfind("--min-count=", 0) == 0)
+        {
+            if (!parseValue(option, minCount))
+            {
+                cerr << "Error: Invalid value in " << option << endl;
+                return 1;
+            }
+        }
+        else if (option.rfind("--threads=", 0) == 0)
+        {
+            if (!parseValue(option, threads) || threads == 0)
+            {
+                cerr << "Error: Invalid value in " << option << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            cerr << "Error: Unknown option " << option << endl;
+            return 1;
+        }
+    }
+
+    removeTrailingSlash(kDBPath);
+    kDBPath += "/" + findPrefix(kDBPath);
+    if (outPath.empty())
+        outPath = kDBPath + FIBS_EXTENSION;
+
+    auto start = chrono::steady_clock::now();
+    CKMCFile db;
+    if (!db.OpenForListing(kDBPath))
+    {
+        cerr << "Error: Could not open KMC database" << endl;
+        return 1;
+    }
+    if (minCount && !db.SetMinCount(minCount))
+    {
+        cerr << "Error: Min count " << minCount << " is outside the counts of the database" << endl;
+        return 1;
+    }
+    CKMCFileInfo info;
+    db.Info(info);
+
+    // The hash is built from the k-mers' hashes alone; the k-mers are read again to fill the slots
+    vector<uint64_t> hashes;
+    hashes.reserve(info.total_kmers);
+    const uint words = kmerWords(info.kmer_length);
+    CKmerValue kmer(info.kmer_length);
+    uint64 counter, packed[MAX_KMER_ROWS];
+    while (db.ReadNextKmer(kmer, counter))
+    {
+        kmer.to_long(packed);
+        hashes.push_back(fibsKmerHash(packed, words));
+    }
+    uint64_t kmerCount = hashes.size();
+
+    string error = writeFibsIndex(outPath, kDBPath, info.kmer_length, fingerprintBits, minCount, hashes, threads, [&](auto &&add)
+                                  {
+                                      db.RestartListing();
+                                      while (db.ReadNextKmer(kmer, counter))
+                                      {
+                                          kmer.to_long(packed);
+                                          add(packed);
+                                      } });
+    db.Close();
+    if (!error.empty())
+    {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+
+    FibsHeader header;
+    FibsIndex::readHeader(outPath, header);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Wrote " << outPath << " in " << seconds << "s\n"
+         << "K-mers: " << kmerCount << '\n'
+         << "Hash levels: " << header.levels << " (" << double(header.levelStart[header.levels]) / max<uint64_t>(kmerCount, 1)
+         << " bits per k-mer), " << header.fallbackCount << " k-mers in the fallback table\n"
+         << "Slots: " << (fingerprintBits ? to_string(fingerprintBits) + "-bit fingerprints" : string("whole k-mers")) << '\n'
+         << "File size: " << header.fileSize / 1e6 << " MB" << endl;
+    return 0;
+}
@@ -7,19 +7,250 @@
 #include <vector>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 #include <filesystem>
+#include <charconv>
 
 #include <boost/progress.hpp>
 
 #include "thread_pool.hpp"
 #include "Window.hpp"
 #include "Utils.hpp"
+#include "KmerEncoder.hpp"
+#include "FibsIndex.hpp"
+#include "Numa.hpp"
 #include "../KMC/kmc_api/kmc_file.h"
 
 #define CHUNK_SIZE 1000000 // defines the size of each sequence chunk when processing files
+// K-mers sent to the database in one bucket-grouped lookup. The batch buffers of every worker
+// (k-mers, aligned copies, entries, counters, positions) stay a few MB at this size, while
+// bucket grouping already finds its locality; larger batches only multiply scratch memory
+#define LOOKUP_BATCH_SIZE (1 << 16)
 
 mutex m;
 
+// How window stats treat k-mers covering lowercase (soft-masked) reference bases:
+// Ignore counts them like any other k-mer, Exclude leaves them out of the stats, and
+// Separate leaves them out but reports them in their own columns
+enum class SoftMaskMode
+{
+    Ignore,
+    Exclude,
+    Separate
+};
+
+// How the k-mers of a window or sequence are looked up: Batch collects them and looks them
+// up grouped by database bucket (CKMCFile::CheckKmers); Read hands every run of ACGT bases
+// to CKMCFile::GetCountersForRead, which works per super-k-mer and, for KMC2 databases,
+// finds the signature bin once for all of its k-mers
+enum class LookupPath
+{
+    Batch,
+    Read
+};
+
+// Where a loaded database is placed on machines with several NUMA nodes: Off leaves it on
+// the node of the loading threads, Interleave spreads its pages over all nodes, and Replicate
+// loads a copy on every node, binding each worker thread to a node and its copy
+enum class NumaMode
+{
+    Off,
+    Interleave,
+    Replicate
+};
+
+inline bool parseSoftMaskMode(const string &name, SoftMaskMode &mode)
+{
+    if (name == "ignore")
+        mode = SoftMaskMode::Ignore;
+    else if (name == "exclude")
+        mode = SoftMaskMode::Exclude;
+    else if (name == "separate")
+        mode = SoftMaskMode::Separate;
+    else
+        return false;
+    return true;
+}
+
+// Options given to the tools as --name=value after their positional arguments
+struct KmerDatabaseOptions
+{
+    SoftMaskMode softMaskMode = SoftMaskMode::Ignore;
+    LookupPath lookup = LookupPath::Batch;  // a FIBS index is always looked up in batches
+    CKMCFile::suffix_layout layout = CKMCFile::layout_sorted;
+    CKMCFile::search_mode search = CKMCFile::search_binary;
+    uint32 loadFlags = CKMCFile::load_read;
+    uint32 loadThreads = thread::hardware_concurrency();
+    CKMCFile::huge_pages hugePages = CKMCFile::huge_transparent;  // pages the LUT and suffix records are read into
+    NumaMode numa = NumaMode::Off;  // not for FIBS indexes or shared segments, which are mapped
+    uint32 minCount = 0;  // k-mers counted below this are treated as absent
+    uint32 filterBits = 0;  // bits per k-mer of the Bloom filter checked before lookups, 0 for none
+    string sharedSegment;  // attach to this KDBShare segment instead of loading, when it holds the database
+};
+
+inline bool parseDatabaseOption(const string &arg, KmerDatabaseOptions &options)
+{
+    size_t separator = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || separator == string::npos)
+        return false;
+    string name = arg.substr(2, separator - 2);
+    string value = arg.substr(separator + 1);
+    if (name == "soft-mask")
+        return parseSoftMaskMode(value, options.softMaskMode);
+    if (name == "lookup")
+    {
+        if (value == "batch")
+            options.lookup = LookupPath::Batch;
+        else if (value == "read")
+            options.lookup = LookupPath::Read;
+        else
+            return false;
+        return true;
+    }
+    if (name == "layout")
+    {
+        if (value == "sorted")
+            options.layout = CKMCFile::layout_sorted;
+        else if (value == "eytzinger")
+            options.layout = CKMCFile::layout_eytzinger;
+        else if (value == "compressed")
+            options.layout = CKMCFile::layout_compressed;
+        else
+            return false;
+        return true;
+    }
+    if (name == "search")
+    {
+        if (value == "binary")
+            options.search = CKMCFile::search_binary;
+        else if (value == "interpolation")
+            options.search = CKMCFile::search_interpolation;
+        else
+            return false;
+        return true;
+    }
+    if (name == "load")
+    {
+        options.loadFlags &= ~(CKMCFile::load_mmap | CKMCFile::load_populate);
+        if (value == "mmap")
+            options.loadFlags |= CKMCFile::load_mmap;
+        else if (value == "populate")
+            options.loadFlags |= CKMCFile::load_mmap | CKMCFile::load_populate;
+        else if (value != "read")
+            return false;
+        return true;
+    }
+    if (name == "load-threads")
+    {
+        auto [end, error] = from_chars(value.data(), value.data() + value.size(), options.loadThreads);
+        return error == errc() && end == value.data() + value.size() && options.loadThreads > 0;
+    }
+    if (name == "huge-pages")
+    {
+        if (value == "off")
+            options.hugePages = CKMCFile::huge_none;
+        else if (value == "thp")
+            options.hugePages = CKMCFile::huge_transparent;
+        else if (value == "2m")
+            options.hugePages = CKMCFile::huge_explicit_2m;
+        else if (value == "1g")
+            options.hugePages = CKMCFile::huge_explicit_1g;
+        else
+            return false;
+        return true;
+    }
+    if (name == "numa")
+    {
+        if (value == "off")
+            options.numa = NumaMode::Off;
+        else if (value == "interleave")
+            options.numa = NumaMode::Interleave;
+        else if (value == "replicate")
+            options.numa = NumaMode::Replicate;
+        else
+            return false;
+        return true;
+    }
+    if (name == "counters")
+    {
+        if (value == "drop")
+            options.loadFlags |= CKMCFile::load_presence_only;
+        else if (value == "keep")
+            options.loadFlags &= ~CKMCFile::load_presence_only;
+        else
+            return false;
+        return true;
+    }
+    if (name == "min-count")
+    {
+        auto [end, error] = from_chars(value.data(), value.data() + value.size(), options.minCount);
+        return error == errc() && end == value.data() + value.size();
+    }
+    if (name == "filter-bits")
+    {
+        auto [end, error] = from_chars(value.data(), value.data() + value.size(), options.filterBits);
+        return error == errc() && end == value.data() + value.size();
+    }
+    if (name == "shm")
+    {
+        options.sharedSegment = value;
+        return !value.empty();
+    }
+    if (name == "advise")
+    {
+        options.loadFlags &= ~(CKMCFile::load_random | CKMCFile::load_hugepage);
+        size_t start = 0;
+        while (start <= value.size())
+        {
+            size_t end = min(value.find(',', start), value.size());
+            string advice = value.substr(start, end - start);
+            if (advice == "random")
+                options.loadFlags |= CKMCFile::load_random;
+            else if (advice == "hugepage")
+                options.loadFlags |= CKMCFile::load_hugepage;
+            else
+                return false;
+            start = end + 1;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Help text of the options parseDatabaseOption takes, shared by the tools' usage messages
+inline void printDatabaseOptions(ostream &out)
+{
+    out << "  --lookup=<path>     How k-mers are looked up: batch (default; grouped by\n"
+        << "                      database bucket), or read (KMC's GetCountersForRead over\n"
+        << "                      every run of ACGT bases)\n"
+        << "  --layout=<layout>   Order of suffix records in memory: sorted (default),\n"
+        << "                      eytzinger (rearranged once at load time for faster lookups),\n"
+        << "                      or compressed (Elias-Fano coded at load time: less memory,\n"
+        << "                      slower lookups; --load and --search do not apply)\n"
+        << "  --search=<method>   Search of sorted buckets: binary (default), or interpolation\n"
+        << "                      (guesses positions from k-mer values; ignored with eytzinger)\n"
+        << "  --load=<mode>       How the suffix file is loaded: read (default), mmap (map it;\n"
+        << "                      pages load on first use and are shared between jobs), or\n"
+        << "                      populate (map it and load all pages up front)\n"
+        << "  --advise=<list>     With mmap/populate, comma-separated paging hints: random\n"
+        << "                      (no readahead), hugepage (transparent huge pages)\n"
+        << "  --load-threads=<n>  Threads reading the database files (default: all cores)\n"
+        << "  --huge-pages=<mode> Pages the database is read into: thp (default; transparent\n"
+        << "                      huge pages), 2m or 1g (reserved hugetlbfs pages, else thp),\n"
+        << "                      or off\n"
+        << "  --numa=<mode>       On multi-socket machines: replicate (a copy of the database\n"
+        << "                      read into every NUMA node, each worker thread bound to a node;\n"
+        << "                      --load does not apply), interleave (pages spread over the\n"
+        << "                      nodes), or off (default)\n"
+        << "  --counters=<mode>   keep (default), or drop them while loading to save memory\n"
+        << "  --min-count=<n>     Treat k-mers counted fewer than <n> times as absent; with\n"
+        << "                      --counters=drop they are not loaded at all\n"
+        << "  --filter-bits=<n>   Build a Bloom filter of <n> bits per k-mer (e.g. 10) at load\n"
+        << "                      time, so that most absent k-mers skip the exact search\n"
+        << "  --shm=<segment>     Attach to the database loaded into <segment> by KDBShare,\n"
+        << "                      falling back to loading it if the segment does not hold it\n";
+}
+
 class KmerDatabase
 {
 public:
@@ -30,6 +261,20 @@ public:
 
     void printKMCInfo()
     {
+        if (fibs.isOpen())
+        {
+            const FibsHeader &info = fibs.info();
+            std::cout << "********** FIBS Index Info **********\n";
+            std::cout << "K-mer length: " << info.kmerLength << '\n';
+            std::cout << "Total k-mers: " << info.kmerCount << '\n';
+            std::cout << "Min count: " << info.minCount << '\n';
+            std::cout << "Slots: " << (info.fingerprintBits ? to_string(info.fingerprintBits) + "-bit fingerprints" : string("whole k-mers")) << '\n';
+            std::cout << "Hash levels: " << info.levels << " (" << double(info.levelStart[info.levels]) / max<uint64_t>(info.kmerCount, 1) << " bits per k-mer)\n";
+            std::cout << "Fallback k-mers: " << info.fallbackCount << '\n';
+            std::cout << "File size: " << info.fileSize / 1e6 << " MB, mapped\n";
+            std::cout << "Lookup engine: " << (engine.kmerSize ? "k=" + to_string(engine.kmerSize) : "generic, " + to_string(engine.words) + " word(s)") << '\n';
+            return;
+        }
         std::cout << "********** KMC Info **********\n";
         std::cout << "K-mer length: " << KMCInfo.kmer_length << '\n';
         std::cout << "Mode: " << KMCInfo.mode << '\n';
@@ -40,114 +285,196 @@ public:
         std::cout << "Max count: " << KMCInfo.max_count << '\n';
         std::cout << "Both strands: " << KMCInfo.both_strands << '\n';
         std::cout << "Total k-mers: " << KMCInfo.total_kmers << '\n';
+        std::cout << "Lookup engine: " << (engine.kmerSize ? "k=" + to_string(engine.kmerSize) : "generic, " + to_string(engine.words) + " word(s)") << '\n';
+        std::cout << "K-mer lookup: " << (options.lookup == LookupPath::Read ? "per read (GetCountersForRead)" : "batched") << '\n';
+        CKMCFile::suffix_layout layout = KMCDatabase.GetSuffixLayout();
+        std::cout << "Suffix layout: " << (layout == CKMCFile::layout_eytzinger ? "eytzinger" : layout == CKMCFile::layout_compressed ? "compressed (Elias-Fano)" : "sorted") << '\n';
+        if (layout == CKMCFile::layout_compressed)
+        {
+            CKMCSufixStats sufixes = KMCDatabase.GetSufixStats();
+            std::cout << "Suffix records: " << sufixes.bytes / 1e6 << " MB, " << double(sufixes.plain_bytes) / max<uint64>(sufixes.bytes, 1)
+                      << "x smaller than sorted with its LUT (" << sufixes.high_bits << " key bits in unary, " << sufixes.low_bits << " packed, "
+                      << sufixes.counter_bits << "-bit counters)\n";
+        }
+        std::cout << "Bucket search: " << (options.search == CKMCFile::search_interpolation ? "interpolation" : "binary") << '\n';
+        std::cout << "Small bucket scan: " << CKMCFile::ScanKernelName() << '\n';
+        if (loadSeconds > 0)
+        {
+            double gigabytes = (filesystem::file_size(sourcePath + ".kmc_pre") + filesystem::file_size(sourcePath + ".kmc_suf")) / 1e9;
+            std::cout << "Read rate: " << gigabytes / loadSeconds << " GB/s (" << gigabytes << " GB, " << options.loadThreads << " threads)\n";
+        }
+        if (options.filterBits)
+            std::cout << "Filter: blocked Bloom, " << options.filterBits << " bits per k-mer, "
+                      << KMCDatabase.GetFilterStats().bytes / 1e6 << " MB, built in " << filterSeconds << "s\n";
+        CKMCPageStats pages{};
+        forEachDatabase([&](CKMCFile &db)
+                        {
+                            CKMCPageStats replica = db.GetPageStats();
+                            pages.bytes += replica.bytes;
+                            pages.huge_bytes += replica.huge_bytes; });
+        std::cout << "Huge pages: " << pages.huge_bytes / 1e6 << " of " << pages.bytes / 1e6 << " MB ("
+                  << (pages.bytes ? 100.0 * pages.huge_bytes / pages.bytes : 0.0) << "%)\n";
+        if (!numaNodeList.empty())
+            std::cout << "NUMA: " << (options.numa == NumaMode::Replicate ? "replicated on " : "interleaved over ") << numaNodeList.size() << " nodes\n";
+        std::cout << "Suffix file: ";
+        switch (KMCDatabase.GetSufixLoadMode())
+        {
+        case CKMCFile::loaded_shared:
+            std::cout << "shared segment " << options.sharedSegment;
+            break;
+        case CKMCFile::loaded_elias_fano:
+            std::cout << "read, Elias-Fano coded";
+            break;
+        case CKMCFile::loaded_compacted:
+            std::cout << "read, counters dropped";
+            break;
+        case CKMCFile::loaded_populated:
+            std::cout << "mapped, populated";
+            break;
+        case CKMCFile::loaded_mapped:
+            std::cout << "mapped";
+            break;
+        default:
+            std::cout << ((options.loadFlags & CKMCFile::load_mmap) ? "read (could not be mapped)" : "read");
+        }
+        std::cout << '\n';
     }
 
-    KmerDatabase(string sourcePath, bool listing = false) : sourcePath(sourcePath)
+    // sourcePath is a database path without extension. A FIBS index there (see kmc2fibs) is used
+    // instead of the KMC files, except for listing when the KMC files are present too, and when
+    // the KMC files were rewritten after the index was made from them
+    KmerDatabase(string sourcePath, bool listing = false, const KmerDatabaseOptions &databaseOptions = {})
+        : sourcePath(sourcePath), options(databaseOptions)
     {
-        if (!listing && !KMCDatabase.OpenForRA(sourcePath.c_str()))
+        if (useFibsIndex(listing))
         {
-            std::cerr << "Error: Could not open KMC database\n";
-            exit(1);
+            openFibsIndex(listing);
+            return;
+        }
+        KMCDatabase.SetHugePages(options.hugePages);
+        KMCDatabase.SetLoadFlags(options.loadFlags);
+        KMCDatabase.SetLoadThreads(options.loadThreads);
+        KMCDatabase.SetLoadMinCount(options.minCount);
+        // a segment loaded with --counters=drop only holds the k-mers its --min-count kept
+        if (!listing && !options.sharedSegment.empty())
+        {
+            sharedAttached = KMCDatabase.OpenForRAShared(options.sharedSegment, sourcePath);
+            if (sharedAttached)
+                warnIgnoredBySegment();
+            else
+                std::cerr << "Warning: Segment " << options.sharedSegment << " does not hold this database with the same --counters and"
+                          << " --min-count, loading it instead\n";
         }
-        else if (listing && !KMCDatabase.OpenForListing(sourcePath.c_str()))
+        if (!listing && !sharedAttached && options.numa != NumaMode::Off)
+        {
+            numaNodeList = numaNodes();
+            if (numaNodeList.size() < 2)
+            {
+                std::cerr << "Warning: This machine has a single NUMA node, ignoring --numa\n";
+                numaNodeList.clear();
+            }
+            // mapped copies would all share the same page cache pages, wherever those are
+            else if (options.numa == NumaMode::Replicate && (options.loadFlags & CKMCFile::load_mmap))
+            {
+                std::cerr << "Warning: --numa=replicate reads a copy of the database into every node's memory, ignoring --load\n";
+                options.loadFlags &= ~(CKMCFile::load_mmap | CKMCFile::load_populate);
+                KMCDatabase.SetLoadFlags(options.loadFlags);
+            }
+        }
+        auto start = chrono::high_resolution_clock::now();
+        bool opened = true;
+        if (listing)
+            opened = KMCDatabase.OpenForListing(sourcePath.c_str());
+        else if (!sharedAttached)
+            startPlaced(0, [&]
+                        { opened = KMCDatabase.OpenForRA(sourcePath.c_str(), options.layout); })
+                .join();
+        if (!opened)
         {
             std::cerr << "Error: Could not open KMC database\n";
             exit(1);
         }
+        // only a plain read measures the file system; mapping defers it and Eytzinger adds relayout time
+        if (KMCDatabase.GetSufixLoadMode() == CKMCFile::loaded_read && options.layout == CKMCFile::layout_sorted)
+            loadSeconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
 
+        KMCDatabase.SetSearchMode(options.search);
+        if (!listing && options.filterBits)
+        {
+            start = chrono::high_resolution_clock::now();
+            startPlaced(0, [&]
+                        { KMCDatabase.BuildFilter(options.filterBits); })
+                .join();
+            filterSeconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        }
+        if (options.minCount && !(options.loadFlags & CKMCFile::load_presence_only) && !KMCDatabase.SetMinCount(options.minCount))
+            std::cerr << "Warning: Min count " << options.minCount << " is outside the counts of the database, ignoring it\n";
+        if (options.numa == NumaMode::Replicate && !numaNodeList.empty())
+            loadReplicas();
+        if (!listing && !sharedAttached && (options.hugePages == CKMCFile::huge_explicit_2m || options.hugePages == CKMCFile::huge_explicit_1g))
+        {
+            uint64 missed = 0;
+            forEachDatabase([&](CKMCFile &db)
+                            { missed += db.GetPageStats().pool_missed; });
+            if (missed)
+                std::cerr << "Warning: The hugetlbfs pool could not hold " << missed / 1e6 << " MB of the database, which is on"
+                          << " transparent huge pages instead (reserve more pages in /sys/kernel/mm/hugepages)\n";
+        }
         KMCDatabase.Info(KMCInfo);
         kmerSize = KMCInfo.kmer_length;
+        if (kmerSize == 0 || kmerSize > MAX_K)
+        {
+            std::cerr << "Error: Unsupported k-mer length " << kmerSize << "\n";
+            exit(1);
+        }
+        engine = selectKmerEngine(kmerSize);
         // printKMCInfo(KMCInfo);
     }
 
-    bool isKmer(CKmerAPI &kmer)
+    bool isKmer(const CKmerValue &kmer)
     {
-        return KMCDatabase.IsKmer(kmer);
+        if (fibs.isOpen())
+        {
+            uint64 words[MAX_KMER_ROWS];
+            kmer.to_long(words);
+            return fibs.contains(words);
+        }
+        return localDatabase().IsKmer(kmer);
     }
 
-    bool readNextKmer(CKmerAPI &kmer)
+    bool readNextKmer(CKmerValue &kmer)
     {
+        if (fibs.isOpen())
+        {
+            if (fibsListPosition == fibs.info().kmerCount)
+                return false;
+            uint64 words[MAX_KMER_ROWS];
+            fibs.kmerAt(fibsListPosition++, words);
+            kmer.from_long(words, kmerSize);
+            return true;
+        }
         uint32 count;
         return KMCDatabase.ReadNextKmer(kmer, count);
     }
 
     bool restartListing()
     {
+        if (fibs.isOpen())
+        {
+            fibsListPosition = 0;
+            return true;
+        }
         return KMCDatabase.RestartListing();
     }
 
-    Window getStatsFromSequence(const tuple<string, size_t, size_t, string> &window)
+    Window getStatsFromSequence(const SequenceChunk &window)
     {
-        Window stats;
-        stats.id = get<0>(window);
-        stats.start = get<1>(window);
-        stats.end = get<2>(window);
-        auto sequence = get<3>(window);
-
-        auto kmers = getCanonicalKmers(sequence, kmerSize);
-        stats.totalKmers = kmers.size();
-
-        int gapSize = 0;
-        CKmerAPI KMCKmer;
-        for (const auto &kmer : kmers)
-        {
-            KMCKmer.from_string(kmer);
-            if (!KMCDatabase.IsKmer(KMCKmer))
-            {
-                gapSize += 1;
-            }
-            else
-            {
-                stats.observedKmers += 1;
-                if (gapSize > 0)
-                {
-                    stats.addVariationOriginal(gapSize, int(kmerSize));
-                    gapSize = 0;
-                }
-            }
-        }
-        if (gapSize > 0)
-            stats.addVariationOriginal(gapSize, kmerSize);
-
-        return stats;
+        return (this->*engine.stats)(window);
     }
 
-
-    pair<string,string> getMappingFromSequence(const string &id, string sequence)
+    pair<string,string> getMappingFromSequence(const string &id, const string &sequence)
     {
-        auto seqSize = sequence.size();
-        vector<short> mapping(seqSize, 0);
-        for (size_t i = 0; i <= seqSize - kmerSize; i++)
-        {
-            string kmer = sequence.substr(i, kmerSize);
-            transform(kmer.begin(), kmer.end(), kmer.begin(), ::toupper);
-            if (kmer.find_first_not_of("ACGT") != string::npos)
-                continue;
-            string revComplement = reverseComplement(kmer);
-            string canonicalKmer = kmer > revComplement ? revComplement : kmer;
-            CKmerAPI KMCKmer;
-            KMCKmer.from_string(canonicalKmer);            
-            if (KMCDatabase.IsKmer(KMCKmer))
-            {
-                for (size_t j = 0; j < kmerSize; j++)
-                {
-                    mapping[i + j] += 1;
-                }
-            }
-        }
-
-        string mappingStr;
-        for (auto m : mapping)
-        {
-            mappingStr += to_string(m) + ",";
-        }
-
-        if (!mappingStr.empty())
-        {
-            mappingStr.pop_back();
-        }
-
-        return {id, mappingStr};
+        return (this->*engine.mapping)(id, sequence);
     }
 
     size_t getTotalLength(const vector<string> &sequences)
@@ -174,17 +501,19 @@ public:
         cout << "Reading sequences" << endl;
         bool compressed = refPath.find(".gz") != string::npos;
         auto result = readSequenceFile(refPath, compressed);
-        auto sequences = result.sequences;
-        auto ids = result.ids;
-        vector<tuple<string, size_t, size_t, string>> chunks;
+        const auto &sequences = result.sequences;
+        const auto &ids = result.ids;
+        vector<SequenceChunk> chunks;
         chunks.reserve(estimateNumChunks(sequences, windowSize));
         chunkSequences(ids, sequences, windowSize, kmerSize, chunks);
 
-        cout << "Number of chunks: " << chunks.size() << endl;
+        cout << "Number of chunks: " << chunks.size() << " (packed with " << packKernel().name << ")" << endl;
 
         /************************************************************/
 
         cout << "Calculating stats" << endl;
+        resetLookupCount();
+        auto start = chrono::high_resolution_clock::now();
         vector<Window> statsResult(chunks.size());
         thread_pool pool;
         boost::progress_display progressBar(chunks.size());
@@ -197,6 +526,7 @@ public:
         }
         pool.wait_for_tasks();
         cout << endl;
+        printLookupRate(start);
 
         /************************************************************/
 
@@ -204,13 +534,21 @@ public:
         ofstream statsFile(outPath);
         if (statsFile.is_open())
         {
-            statsFile << "seqname\tstart\tend\ttotal_kmers\tobserved_kmers\tvariations\tkmer_distance\n";
+            bool separateSoftMasked = options.softMaskMode == SoftMaskMode::Separate;
+            statsFile << "seqname\tstart\tend\ttotal_kmers\tobserved_kmers\tvariations\tkmer_distance\tn_bases";
+            if (separateSoftMasked)
+                statsFile << "\tsoft_masked_kmers\tobserved_soft_masked_kmers";
+            statsFile << '\n';
             for (size_t i = 0; i < statsResult.size(); i++)
             {
                 auto stats = statsResult[i];
                 statsFile << stats.id << '\t' << stats.start << '\t' << stats.end << '\t'
                           << stats.totalKmers << '\t' << stats.observedKmers << '\t'
-                          << stats.variations << '\t' << stats.kmerDistance << endl;
+                          << stats.variations << '\t' << stats.kmerDistance << '\t'
+                          << stats.ambiguousBases;
+                if (separateSoftMasked)
+                    statsFile << '\t' << stats.softMaskedKmers << '\t' << stats.observedSoftMaskedKmers;
+                statsFile << endl;
             }
             statsFile.close();
         }
@@ -228,12 +566,14 @@ void produceMapping(string refPath, string outPath)
         cout << "Reading sequences" << endl;
         bool compressed = refPath.find(".gz") != string::npos;
         auto result = readSequenceFile(refPath, compressed);
-        auto sequences = result.sequences;
-        auto ids = result.ids;
+        const auto &sequences = result.sequences;
+        const auto &ids = result.ids;
 
         /************************************************************/
 
         cout << "Calculating mapping" << endl;
+        resetLookupCount();
+        auto start = chrono::high_resolution_clock::now();
         vector<pair<string, string>> mappingResult(sequences.size());
         thread_pool pool;
         boost::progress_display progressBar(sequences.size());
@@ -246,6 +586,7 @@ void produceMapping(string refPath, string outPath)
         }
         pool.wait_for_tasks();
         cout << endl;
+        printLookupRate(start);
 
         /************************************************************/
 
@@ -268,8 +609,484 @@ void produceMapping(string refPath, string outPath)
 
 
 private:
+    // Whether to open the FIBS index at sourcePath rather than the KMC files. Where the KMC files
+    // are there too, an index that was made from other versions of them (or by an older kmc2fibs)
+    // is passed over with a warning
+    bool useFibsIndex(bool listing)
+    {
+        string indexPath = sourcePath + FIBS_EXTENSION;
+        if (!filesystem::exists(indexPath))
+            return false;
+        if (!filesystem::exists(sourcePath + ".kmc_pre") || !filesystem::exists(sourcePath + ".kmc_suf"))
+            return true;
+        if (listing)
+            return false;
+        FibsHeader header;
+        if (!FibsIndex::readHeader(indexPath, header) || !fibsSourceMatches(header, sourcePath))
+        {
+            std::cerr << "Warning: FIBS index " << indexPath << " was not made from the KMC database as it is now, using the KMC files"
+                      << " (run kmc2fibs again to update it)\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Add name to ignored, a list of the options given that do not apply, if given
+    static void ignoreOption(string &ignored, bool given, const char *name)
+    {
+        if (given)
+            ignored += (ignored.empty() ? "" : ", ") + string(name);
+    }
+
+    // The segment's layout and placement were chosen by KDBShare, so the options shaping how
+    // the suffix file is loaded and where it is placed do not apply to an attached segment
+    void warnIgnoredBySegment()
+    {
+        const KmerDatabaseOptions defaults;
+        string ignored;
+        ignoreOption(ignored, options.layout != defaults.layout && options.layout != KMCDatabase.GetSuffixLayout(), "--layout");
+        ignoreOption(ignored, options.loadFlags & (CKMCFile::load_mmap | CKMCFile::load_populate), "--load");
+        ignoreOption(ignored, options.loadFlags & (CKMCFile::load_random | CKMCFile::load_hugepage), "--advise");
+        ignoreOption(ignored, options.loadThreads != defaults.loadThreads, "--load-threads");
+        ignoreOption(ignored, options.hugePages == CKMCFile::huge_explicit_2m || options.hugePages == CKMCFile::huge_explicit_1g, "--huge-pages");
+        ignoreOption(ignored, options.numa != defaults.numa, "--numa");
+        if (!ignored.empty())
+            std::cerr << "Warning: " << ignored << " do not apply to segment " << options.sharedSegment
+                      << ", whose layout and pages were set by KDBShare, ignoring them\n";
+    }
+
+    void openFibsIndex(bool listing)
+    {
+        string indexPath = sourcePath + FIBS_EXTENSION;
+        if (!fibs.open(indexPath, options.loadFlags))
+        {
+            std::cerr << "Error: Could not open FIBS index " << indexPath << "\n";
+            exit(1);
+        }
+        if (listing && !fibs.isExact())
+        {
+            std::cerr << "Error: FIBS index " << indexPath << " stores fingerprints, so its k-mers cannot be listed\n";
+            exit(1);
+        }
+        if (!listing)
+        {
+            const FibsHeader &info = fibs.info();
+            // every k-mer of a KMC database is counted at least once, so 0 and 1 leave out none
+            if (max<uint32_t>(options.minCount, 1) != max<uint32_t>(info.minCount, 1))
+            {
+                auto describe = [](uint32_t minCount)
+                { return minCount > 1 ? "--min-count=" + to_string(minCount) : string("no --min-count"); };
+                std::cerr << "Error: FIBS index " << indexPath << " was converted with " << describe(info.minCount) << " but is used with "
+                          << describe(options.minCount) << "; give the same, or convert the database again\n";
+                exit(1);
+            }
+            // the index is mapped as it is, so the options shaping how the KMC files are loaded do not apply
+            const KmerDatabaseOptions defaults;
+            string ignored;
+            ignoreOption(ignored, options.lookup != defaults.lookup, "--lookup");
+            ignoreOption(ignored, options.layout != defaults.layout, "--layout");
+            ignoreOption(ignored, options.search != defaults.search, "--search");
+            ignoreOption(ignored, options.loadFlags & CKMCFile::load_presence_only, "--counters");
+            ignoreOption(ignored, options.loadThreads != defaults.loadThreads, "--load-threads");
+            ignoreOption(ignored, options.hugePages != defaults.hugePages, "--huge-pages");
+            ignoreOption(ignored, options.numa != defaults.numa, "--numa");
+            ignoreOption(ignored, options.filterBits != defaults.filterBits, "--filter-bits");
+            ignoreOption(ignored, !options.sharedSegment.empty(), "--shm");
+            if (!ignored.empty())
+                std::cerr << "Warning: " << ignored << " do not apply to FIBS index " << indexPath << ", ignoring them\n";
+            if (!fibs.isExact())
+                std::cerr << "Warning: FIBS index " << indexPath << " stores " << info.fingerprintBits << "-bit fingerprints, so about 1 in 2^"
+                          << info.fingerprintBits << " absent k-mers is reported present (convert with --fingerprint=exact for exact results)\n";
+        }
+        kmerSize = fibs.info().kmerLength;
+        if (kmerSize == 0 || kmerSize > MAX_K)
+        {
+            std::cerr << "Error: Unsupported k-mer length " << kmerSize << "\n";
+            exit(1);
+        }
+        engine = selectKmerEngine(kmerSize);
+    }
+
+    // Start a thread that runs load with its memory placed for options.numa on the node at
+    // nodeIndex of numaNodeList: bound to the node and preferring its memory for Replicate,
+    // interleaving pages over all nodes for Interleave. Threads started by load (those of
+    // CKMCFile reading the files or building the filter) inherit both.
+    template <typename F>
+    thread startPlaced(size_t nodeIndex, F &&load)
+    {
+        return thread([this, nodeIndex, load]
+                      {
+                          if (options.numa == NumaMode::Replicate && !numaNodeList.empty())
+                          {
+                              bindThreadToNode(numaNodeList[nodeIndex]);
+                              setMemoryPolicy(NUMA_MPOL_PREFERRED, {numaNodeList[nodeIndex]});
+                          }
+                          else if (options.numa == NumaMode::Interleave && !numaNodeList.empty())
+                              setMemoryPolicy(NUMA_MPOL_INTERLEAVE, numaNodeList);
+                          load(); });
+    }
+
+    // Load a copy of the database on every NUMA node but the first, which holds KMCDatabase,
+    // all at once; the files are in the page cache by now
+    void loadReplicas()
+    {
+        replicas.resize(numaNodeList.size() - 1);
+        vector<thread> loaders;
+        atomic<bool> opened = true;
+        for (size_t i = 1; i < numaNodeList.size(); i++)
+            loaders.push_back(startPlaced(i, [&, i]
+                                          {
+                                              auto db = make_unique<CKMCFile>();
+                                              db->SetLoadFlags(options.loadFlags);
+                                              db->SetLoadThreads(max<uint32>(1, options.loadThreads / numaNodeList.size()));
+                                              db->SetLoadMinCount(options.minCount);
+                                              db->SetHugePages(options.hugePages);
+                                              if (!db->OpenForRA(sourcePath.c_str(), options.layout))
+                                              {
+                                                  opened = false;
+                                                  return;
+                                              }
+                                              db->SetSearchMode(options.search);
+                                              if (options.filterBits)
+                                                  db->BuildFilter(options.filterBits);
+                                              if (options.minCount && !(options.loadFlags & CKMCFile::load_presence_only))
+                                                  db->SetMinCount(options.minCount);
+                                              replicas[i - 1] = move(db); }));
+        for (auto &loader : loaders)
+            loader.join();
+        if (!opened)
+        {
+            std::cerr << "Error: Could not load a copy of the KMC database for every NUMA node\n";
+            exit(1);
+        }
+    }
+
+    // The copy of the database on the calling thread's NUMA node. Without replicas this is
+    // KMCDatabase; with them, a thread looking up for the first time is bound to the next
+    // node in turn, so the workers of a pool are spread evenly over the nodes.
+    CKMCFile &localDatabase()
+    {
+        if (replicas.empty())
+            return KMCDatabase;
+        WorkerScratch &scratch = workerScratch();
+        if (scratch.numaNode < 0)
+        {
+            scratch.numaNode = nextWorkerNode++ % numaNodeList.size();
+            bindThreadToNode(numaNodeList[scratch.numaNode]);
+        }
+        return scratch.numaNode == 0 ? KMCDatabase : *replicas[scratch.numaNode - 1];
+    }
+
+    template <typename F>
+    void forEachDatabase(F &&visit)
+    {
+        visit(KMCDatabase);
+        for (auto &replica : replicas)
+            visit(*replica);
+    }
+
+    void resetLookupCount()
+    {
+        lookupCount = 0;
+    }
+
+    void printLookupRate(chrono::high_resolution_clock::time_point start)
+    {
+        chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+        cout << "Lookups: " << lookupCount << " in " << elapsed.count() << " seconds ("
+             << size_t(lookupCount / max(elapsed.count(), 1e-9)) << " lookups/s)" << endl;
+        if (options.filterBits && !fibs.isOpen())
+        {
+            // counted since the filter was built, so later passes include the earlier ones
+            CKMCFilterStats filter{};
+            forEachDatabase([&](CKMCFile &db)
+                            {
+                                CKMCFilterStats replica = db.GetFilterStats();
+                                filter.absent += replica.absent;
+                                filter.queries += replica.queries;
+                                filter.rejected += replica.rejected; });
+            if (filter.queries)
+                cout << "Filter rejected " << filter.rejected << " of " << filter.absent << " absent k-mers ("
+                     << 100.0 * filter.rejected / max<uint64>(filter.absent, 1) << "%), "
+                     << filter.queries - filter.rejected << " of " << filter.queries << " lookups searched" << endl;
+        }
+    }
+
+    // Window loops instantiated for one k-mer size, so that the encoder and the lookup run
+    // with a constant k. kmerSize == 0 marks a generic engine, which reads k at runtime and
+    // only fixes the number of 64-bit words per k-mer.
+    struct KmerEngine
+    {
+        uint kmerSize;
+        uint words;
+        Window (KmerDatabase::*stats)(const SequenceChunk &);
+        pair<string, string> (KmerDatabase::*mapping)(const string &, const string &);
+    };
+
+    template <uint K, uint N = kmerWords(K)>
+    static constexpr KmerEngine makeKmerEngine()
+    {
+        return {K, N, &KmerDatabase::statsFromSequence<K, N>, &KmerDatabase::mappingFromSequence<K, N>};
+    }
+
+    // Pick the engine once, when the database is opened
+    static KmerEngine selectKmerEngine(uint kmerSize)
+    {
+        static const KmerEngine engines[] = {makeKmerEngine<19>(), makeKmerEngine<21>(), makeKmerEngine<25>(),
+                                             makeKmerEngine<27>(), makeKmerEngine<31>(), makeKmerEngine<41>(),
+                                             makeKmerEngine<51>()};
+        static const KmerEngine genericEngines[] = {makeKmerEngine<0, 1>(), makeKmerEngine<0, 2>(), makeKmerEngine<0, 3>(),
+                                                    makeKmerEngine<0, 4>(), makeKmerEngine<0, 5>(), makeKmerEngine<0, 6>(),
+                                                    makeKmerEngine<0, 7>(), makeKmerEngine<0, 8>()};
+        static_assert(size(genericEngines) == kmerWords(MAX_K));
+        for (const auto &engine : engines)
+            if (engine.kmerSize == kmerSize)
+                return engine;
+        return genericEngines[kmerWords(kmerSize) - 1];
+    }
+
+    template <uint K, uint N>
+    Window statsFromSequence(const SequenceChunk &window)
+    {
+        const uint kmerSize = K ? K : this->kmerSize;
+        Window stats;
+        stats.id = get<0>(window);
+        stats.start = get<1>(window);
+        stats.end = get<2>(window);
+        const auto &sequence = get<3>(window);
+        stats.ambiguousBases = sequence.countInvalid();
+
+        int gapSize = 0;
+        auto addLookup = [&](bool found)
+        {
+            stats.totalKmers += 1;
+            if (!found)
+            {
+                gapSize += 1;
+            }
+            else
+            {
+                stats.observedKmers += 1;
+                if (gapSize > 0)
+                {
+                    stats.addVariationOriginal(gapSize, int(kmerSize));
+                    gapSize = 0;
+                }
+            }
+        };
+
+        if (options.softMaskMode == SoftMaskMode::Ignore)
+        {
+            lookupCanonicalKmers<K, N>(sequence, [&](size_t, bool found)
+                                       { addLookup(found); });
+        }
+        else
+        {
+            lookupCanonicalKmers<K, N, true>(sequence, [&](size_t, bool found, bool softMasked)
+                                             {
+                                                if (!softMasked)
+                                                    addLookup(found);
+                                                else
+                                                {
+                                                    stats.softMaskedKmers += 1;
+                                                    stats.observedSoftMaskedKmers += found;
+                                                } });
+        }
+        if (gapSize > 0)
+            stats.addVariationOriginal(gapSize, kmerSize);
+
+        return stats;
+    }
+
+    template <uint K, uint N>
+    pair<string,string> mappingFromSequence(const string &id, const string &sequence)
+    {
+        const uint kmerSize = K ? K : this->kmerSize;
+        auto seqSize = sequence.size();
+        WorkerScratch &scratch = workerScratch();
+        auto &mapping = scratch.coverage;
+        mapping.assign(seqSize, 0);
+        auto addCoverage = [&](size_t position)
+        {
+            for (size_t j = 0; j < kmerSize; j++)
+            {
+                mapping[position + j] += 1;
+            }
+        };
+
+        PackedSequence &packed = scratch.packed;
+        packNucleotides(sequence.data(), seqSize, packed);
+        lookupCanonicalKmers<K, N>(packed, [&](size_t position, bool found)
+                                   {
+                                    if (found)
+                                        addCoverage(position); });
+
+        string &mappingStr = scratch.text;
+        mappingStr.clear();
+        char number[8];
+        for (auto m : mapping)
+        {
+            mappingStr.append(number, to_chars(number, number + sizeof(number), m).ptr);
+            mappingStr += ',';
+        }
+
+        if (!mappingStr.empty())
+        {
+            mappingStr.pop_back();
+        }
+
+        return {id, mappingStr};
+    }
+
+    // Buffers reused by every window or sequence a worker thread processes. They are cleared
+    // rather than freed between tasks, so once they have grown to the largest input the
+    // steady state allocates nothing.
+    struct WorkerScratch
+    {
+        PackedSequence packed;
+        vector<short> coverage;
+        string text;
+        CKmerBatch batch;
+        vector<size_t> positions;
+        vector<uint8_t> softMasked;
+        vector<uint64_t> fibsScratch;
+        vector<uint8_t> found;
+        string read;
+        vector<uint32> counters;
+        int numaNode = -1;  // index into numaNodeList of the node the thread is bound to, -1 if not bound
+    };
+
+    static WorkerScratch &workerScratch()
+    {
+        static thread_local WorkerScratch scratch;
+        return scratch;
+    }
+
+    // Walk the packed sequence with a rolling 2-bit encoder and look every canonical k-mer up,
+    // calling onLookup(position, found) in sequence order. K-mers are collected into batches of
+    // up to LOOKUP_BATCH_SIZE and looked up together, grouped by database bucket. With
+    // TrackSoftMask, onLookup also gets whether the k-mer covers a soft-masked base, and
+    // soft-masked k-mers are not looked up at all in SoftMaskMode::Exclude. LookupPath::Read
+    // hands the work to lookupReadKmers instead.
+    template <uint K, uint N, bool TrackSoftMask = false, typename F>
+    void lookupCanonicalKmers(const PackedSequence &sequence, F &&onLookup)
+    {
+        if (options.lookup == LookupPath::Read && !fibs.isOpen())
+        {
+            lookupReadKmers<TrackSoftMask>(sequence, onLookup);
+            return;
+        }
+        WorkerScratch &scratch = workerScratch();
+        CKmerBatch &batch = scratch.batch;
+        auto &positions = scratch.positions;
+        auto &softMasked = scratch.softMasked;
+        auto reset = [&]
+        {
+            batch.reset(N);
+            positions.clear();
+            softMasked.clear();
+        };
+        auto &found = scratch.found;
+        auto flush = [&]
+        {
+            if (fibs.isOpen())
+                fibs.checkKmers<N>(batch.size() ? batch.kmer(0) : nullptr, batch.size(), scratch.fibsScratch, found);
+            else
+            {
+                localDatabase().CheckKmers<K>(batch);
+                found.resize(batch.size());
+                for (size_t i = 0; i < found.size(); i++)
+                    found[i] = batch.found(i);
+            }
+            lookupCount += batch.size();
+            for (size_t i = 0; i < positions.size(); i++)
+            {
+                if constexpr (TrackSoftMask)
+                    onLookup(positions[i], bool(found[i]), bool(softMasked[i]));
+                else
+                    onLookup(positions[i], bool(found[i]));
+            }
+            reset();
+        };
+        auto addKmer = [&](size_t position, const PackedKmer<N> &kmer)
+        {
+            batch.add(kmer.words);
+            positions.push_back(position);
+            if (positions.size() == LOOKUP_BATCH_SIZE)
+                flush();
+        };
+
+        reset();
+        KmerEncoder<K, N> encoder(kmerSize);
+        if constexpr (TrackSoftMask)
+            encoder.template forEachCanonicalKmer<true>(sequence, [&](size_t position, const PackedKmer<N> &kmer, bool isSoftMasked)
+                                                        {
+                                                            if (isSoftMasked && options.softMaskMode == SoftMaskMode::Exclude)
+                                                                return;
+                                                            softMasked.push_back(isSoftMasked);
+                                                            addKmer(position, kmer); });
+        else
+            encoder.forEachCanonicalKmer(sequence, addKmer);
+        flush();
+    }
+
+    // lookupCanonicalKmers through CKMCFile::GetCountersForRead. Every run of ACGT bases at
+    // least k long is unpacked and looked up as one read, so no k-mer spans a non-ACGT base,
+    // and onLookup is called for the same positions, in the same order. Soft-masked k-mers
+    // are looked up with the rest, since the counters come for the whole run.
+    template <bool TrackSoftMask, typename F>
+    void lookupReadKmers(const PackedSequence &sequence, F &&onLookup)
+    {
+        WorkerScratch &scratch = workerScratch();
+        string &read = scratch.read;
+        auto &counters = scratch.counters;
+        size_t runEnd = 0;
+        for (size_t runStart = sequence.nextValid(0); runStart < sequence.length; runStart = sequence.nextValid(runEnd))
+        {
+            runEnd = sequence.nextInvalid(runStart);
+            if (runEnd - runStart < kmerSize)
+                continue;
+            read.resize(runEnd - runStart);
+            for (size_t i = runStart; i < runEnd; i++)
+                read[i - runStart] = "ACGT"[sequence.baseAt(i)];
+            localDatabase().GetCountersForRead(read, counters);
+            lookupCount += counters.size();
+
+            size_t softMaskedEnd = 0; // one past the last soft-masked base of the k-mers so far
+            for (size_t i = runStart; i < runEnd; i++)
+            {
+                if constexpr (TrackSoftMask)
+                    if (sequence.isSoftMasked(i))
+                        softMaskedEnd = i + 1;
+                if (i + 1 < runStart + kmerSize)
+                    continue;
+                size_t position = i + 1 - kmerSize;
+                bool found = counters[position - runStart] != 0;
+                if constexpr (TrackSoftMask)
+                {
+                    bool isSoftMasked = position < softMaskedEnd;
+                    if (!(isSoftMasked && options.softMaskMode == SoftMaskMode::Exclude))
+                        onLookup(position, found, isSoftMasked);
+                }
+                else
+                    onLookup(position, found);
+            }
+        }
+    }
+
     uint kmerSize, chunkSize = CHUNK_SIZE;
     string sourcePath;
     CKMCFile KMCDatabase;
+    FibsIndex fibs;  // open instead of KMCDatabase when the database has a FIBS index
+    vector<NumaNode> numaNodeList;  // nodes the database is placed on for options.numa, empty if not placed
+    vector<unique_ptr<CKMCFile>> replicas;  // with NumaMode::Replicate, the copies on numaNodeList[1...]
+    atomic<size_t> nextWorkerNode = 0;
+    uint64_t fibsListPosition = 0;
+    bool sharedAttached = false;
+    double loadSeconds = 0;  // time spent reading the files, 0 if they were mapped or shared
+    double filterSeconds = 0;
     CKMCFileInfo KMCInfo;
+    KmerEngine engine;
+    KmerDatabaseOptions options;
+    atomic<size_t> lookupCount = 0;
 };
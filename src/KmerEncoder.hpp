@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+
+#include "NucleotidePacker.hpp"
+#include "../KMC/kmc_api/kmer_defs.h"
+
+#define KMER_WORD_SIZE 32 // bases held by one 64-bit word
+
+using namespace std;
+
+// Number of 64-bit words needed for a k-mer of kmerSize bases
+constexpr uint kmerWords(uint kmerSize)
+{
+    return (kmerSize + KMER_WORD_SIZE - 1) / KMER_WORD_SIZE;
+}
+
+// A k-mer packed as 2-bit bases (A=0, C=1, G=2, T=3), right-aligned over N words with the
+// most significant word first. This is the CKmerAPI::to_long layout, so the words can be
+// handed to CKMCFile::CheckKmer as they are. Ordering follows the ACGT strings.
+template <uint N>
+struct PackedKmer
+{
+    uint64_t words[N] = {};
+
+    // Append a base at the low end; topMask keeps only the k-mer's bits in words[0]
+    void pushBack(uint64_t code, uint64_t topMask)
+    {
+        for (uint i = 0; i + 1 < N; i++)
+            words[i] = (words[i] << 2) | (words[i + 1] >> 62);
+        words[N - 1] = (words[N - 1] << 2) | code;
+        words[0] &= topMask;
+    }
+
+    // Insert a base at the high end, topShift being its bit offset in words[0]
+    void pushFront(uint64_t code, uint topShift)
+    {
+        for (uint i = N - 1; i > 0; i--)
+            words[i] = (words[i] >> 2) | (words[i - 1] << 62);
+        words[0] = (words[0] >> 2) | (code << topShift);
+    }
+
+    bool operator<(const PackedKmer &other) const
+    {
+        for (uint i = 0; i + 1 < N; i++)
+            if (words[i] != other.words[i])
+                return words[i] < other.words[i];
+        return words[N - 1] < other.words[N - 1];
+    }
+};
+
+// K fixes the k-mer size at compile time, so masks and shifts fold into constants in the
+// hot loop; K = 0 takes the size from the constructor instead, and then the number of
+// words N must be given. For k <= 32 everything stays in a single register.
+template <uint K = 0, uint N = kmerWords(K)>
+class KmerEncoder
+{
+    static_assert(K <= MAX_K, "kmer size above the KMC maximum");
+    static_assert(N > 0 && (K == 0 || kmerWords(K) == N), "word count does not match the kmer size");
+
+public:
+    using Kmer = PackedKmer<N>;
+
+    explicit KmerEncoder(uint kmerSize = K) : runtimeKmerSize(kmerSize)
+    {
+        if (kmerSize == 0 || kmerWords(kmerSize) != N || (K && kmerSize != K))
+            throw invalid_argument("Unsupported kmer size for integer encoding");
+    }
+
+    uint getKmerSize() const
+    {
+        return K ? K : runtimeKmerSize;
+    }
+
+    // Walk the packed sequence once, keeping the forward and reverse-complement k-mers up to
+    // date one base at a time. onKmer(position, canonicalKmer) is called for every k-mer made
+    // only of ACGT bases, in sequence order. The canonical k-mer is the smaller of the two.
+    // Ambiguous bases are never visited one by one: the invalid-base mask is searched for the
+    // next run of ACGT bases, and runs shorter than k are skipped whole. Lowercase bases are
+    // encoded like uppercase ones; with TrackSoftMask, onKmer gets a third argument telling
+    // whether the k-mer covers any soft-masked base.
+    template <bool TrackSoftMask = false, typename F>
+    void forEachCanonicalKmer(const PackedSequence &sequence, F &&onKmer) const
+    {
+        const uint kmerSize = getKmerSize();
+        const uint topBits = 2 * kmerSize - 64 * (N - 1);
+        const uint64_t topMask = topBits == 64 ? ~0ULL : (1ULL << topBits) - 1;
+        const uint topShift = topBits - 2;
+
+        Kmer forward, reverse;
+        size_t softMaskedEnd = 0; // one past the last soft-masked base pushed
+        auto pushBase = [&](size_t i)
+        {
+            uint64_t code = sequence.baseAt(i);
+            forward.pushBack(code, topMask);
+            reverse.pushFront(3 - code, topShift);
+            if constexpr (TrackSoftMask)
+                if (sequence.isSoftMasked(i))
+                    softMaskedEnd = i + 1;
+        };
+
+        size_t runEnd = 0;
+        for (size_t runStart = sequence.nextValid(0); runStart < sequence.length; runStart = sequence.nextValid(runEnd))
+        {
+            runEnd = sequence.nextInvalid(runStart);
+            if (runEnd - runStart < kmerSize)
+                continue;
+            size_t i = runStart;
+            for (; i < runStart + kmerSize - 1; i++)
+                pushBase(i);
+            for (; i < runEnd; i++)
+            {
+                pushBase(i);
+                size_t position = i + 1 - kmerSize;
+                if constexpr (TrackSoftMask)
+                    onKmer(position, reverse < forward ? reverse : forward, position < softMaskedEnd);
+                else
+                    onKmer(position, reverse < forward ? reverse : forward);
+            }
+        }
+    }
+
+private:
+    uint runtimeKmerSize;
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NUCLEOTIDE_PACKER_X86
+#endif
+
+using namespace std;
+
+// Lookup table from ASCII to 2-bit base codes (A=0, C=1, G=2, T=3), lowercase included.
+// Anything else maps to INVALID_BASE.
+struct BaseCodeTable
+{
+    static constexpr uint8_t INVALID_BASE = 4;
+    uint8_t codes[256];
+
+    constexpr BaseCodeTable() : codes()
+    {
+        for (int i = 0; i < 256; i++)
+            codes[i] = INVALID_BASE;
+        codes['A'] = codes['a'] = 0;
+        codes['C'] = codes['c'] = 1;
+        codes['G'] = codes['g'] = 2;
+        codes['T'] = codes['t'] = 3;
+    }
+};
+
+inline constexpr BaseCodeTable BASE_CODES{};
+
+// A nucleotide sequence packed as 2-bit codes (32 bases per word, first base in the
+// low bits) plus a bitmask of the positions holding anything other than ACGT, and one of
+// the positions holding a lowercase (soft-masked) acgt base.
+// The code stored at an invalid position is unspecified.
+class PackedSequence
+{
+public:
+    size_t length = 0;
+    vector<uint64_t> bases;
+    vector<uint64_t> invalidBases;
+    vector<uint64_t> softMaskedBases;
+
+    void resize(size_t newLength)
+    {
+        length = newLength;
+        bases.resize((newLength + 31) / 32);
+        invalidBases.resize((newLength + 63) / 64);
+        softMaskedBases.resize((newLength + 63) / 64);
+    }
+
+    uint8_t baseAt(size_t i) const
+    {
+        return (bases[i >> 5] >> ((i & 31) << 1)) & 3;
+    }
+
+    bool isValid(size_t i) const
+    {
+        return !((invalidBases[i >> 6] >> (i & 63)) & 1);
+    }
+
+    bool isSoftMasked(size_t i) const
+    {
+        return (softMaskedBases[i >> 6] >> (i & 63)) & 1;
+    }
+
+    // First position at or after i holding an ACGT base, or length if there is none
+    size_t nextValid(size_t i) const
+    {
+        return findNext(i, ~0ULL);
+    }
+
+    // First position at or after i holding anything other than ACGT, or length if there is none
+    size_t nextInvalid(size_t i) const
+    {
+        return findNext(i, 0);
+    }
+
+    size_t countInvalid() const
+    {
+        size_t count = 0;
+        for (uint64_t word : invalidBases)
+            count += __builtin_popcountll(word);
+        return count;
+    }
+
+private:
+    // Scan the invalid-base mask 64 positions at a time; flip selects which bit value to look for
+    size_t findNext(size_t i, uint64_t flip) const
+    {
+        if (i >= length)
+            return length;
+        size_t word = i >> 6;
+        uint64_t bits = (invalidBases[word] ^ flip) & (~0ULL << (i & 63));
+        while (!bits)
+        {
+            if (++word == invalidBases.size())
+                return length;
+            bits = invalidBases[word] ^ flip;
+        }
+        return min(length, (word << 6) + __builtin_ctzll(bits));
+    }
+};
+
+// A packing kernel writes ceil(length / 32) base words, and ceil(length / 64) words to each
+// of the invalid-base and soft-masked masks
+using PackKernel = void (*)(const char *sequence, size_t length, uint64_t *bases, uint64_t *invalidBases, uint64_t *softMasked);
+
+inline void packNucleotidesScalar(const char *sequence, size_t length, uint64_t *bases, uint64_t *invalidBases, uint64_t *softMasked)
+{
+    for (size_t start = 0; start < length; start += 64)
+    {
+        size_t blockLength = min<size_t>(64, length - start);
+        uint64_t words[2] = {0, 0};
+        uint64_t invalid = 0, lowercase = 0;
+        for (size_t i = 0; i < blockLength; i++)
+        {
+            unsigned char base = sequence[start + i];
+            uint8_t code = BASE_CODES.codes[base];
+            invalid |= uint64_t(code >> 2) << i;
+            lowercase |= uint64_t((base >> 5) & 1) << i;
+            words[i >> 5] |= uint64_t(code & 3) << ((i & 31) << 1);
+        }
+        bases[start / 32] = words[0];
+        if (blockLength > 32)
+            bases[start / 32 + 1] = words[1];
+        invalidBases[start / 64] = invalid;
+        softMasked[start / 64] = lowercase & ~invalid;
+    }
+}
+
+#ifdef NUCLEOTIDE_PACKER_X86
+
+// Both SIMD kernels work the same way: fold the case bit away, compare against the four
+// uppercase bases to get the validity mask, map the low nibble of each base to its code
+// with a byte shuffle (A=0x41, C=0x43, G=0x47, T=0x54), then squeeze four codes per
+// byte with two multiply-add steps. The case bit (0x20) moved to the top of each byte
+// gives the lowercase mask.
+
+__attribute__((target("sse4.2"))) inline uint32_t packCodesSSE42(__m128i codes)
+{
+    __m128i pairs = _mm_maddubs_epi16(codes, _mm_set1_epi16(0x0401));
+    __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00100001));
+    __m128i packed = _mm_shuffle_epi8(quads, _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    return _mm_cvtsi128_si32(packed);
+}
+
+__attribute__((target("sse4.2"))) inline void packNucleotidesSSE42(const char *sequence, size_t length, uint64_t *bases, uint64_t *invalidBases, uint64_t *softMasked)
+{
+    const __m128i caseMask = _mm_set1_epi8(char(0xDF));
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+    const __m128i codeTable = _mm_setr_epi8(0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i baseA = _mm_set1_epi8('A'), baseC = _mm_set1_epi8('C');
+    const __m128i baseG = _mm_set1_epi8('G'), baseT = _mm_set1_epi8('T');
+
+    size_t start = 0;
+    for (; start + 64 <= length; start += 64)
+    {
+        uint64_t valid = 0, lowercase = 0;
+        uint32_t packed[4];
+        for (int part = 0; part < 4; part++)
+        {
+            __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(sequence + start + 16 * part));
+            __m128i upper = _mm_and_si128(chars, caseMask);
+            __m128i isBase = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(upper, baseA), _mm_cmpeq_epi8(upper, baseC)),
+                                          _mm_or_si128(_mm_cmpeq_epi8(upper, baseG), _mm_cmpeq_epi8(upper, baseT)));
+            valid |= uint64_t(uint16_t(_mm_movemask_epi8(isBase))) << (16 * part);
+            lowercase |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_slli_epi16(chars, 2)))) << (16 * part);
+            packed[part] = packCodesSSE42(_mm_shuffle_epi8(codeTable, _mm_and_si128(upper, nibbleMask)));
+        }
+        bases[start / 32] = packed[0] | uint64_t(packed[1]) << 32;
+        bases[start / 32 + 1] = packed[2] | uint64_t(packed[3]) << 32;
+        invalidBases[start / 64] = ~valid;
+        softMasked[start / 64] = lowercase & valid;
+    }
+    if (start < length)
+        packNucleotidesScalar(sequence + start, length - start, bases + start / 32, invalidBases + start / 64, softMasked + start / 64);
+}
+
+__attribute__((target("avx2"))) inline uint64_t packCodesAVX2(__m256i codes)
+{
+    __m256i pairs = _mm256_maddubs_epi16(codes, _mm256_set1_epi16(0x0401));
+    __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00100001));
+    __m256i packed = _mm256_shuffle_epi8(quads, _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                                 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    return uint32_t(_mm256_cvtsi256_si32(packed)) | uint64_t(uint32_t(_mm256_extract_epi32(packed, 4))) << 32;
+}
+
+__attribute__((target("avx2"))) inline void packNucleotidesAVX2(const char *sequence, size_t length, uint64_t *bases, uint64_t *invalidBases, uint64_t *softMasked)
+{
+    const __m256i caseMask = _mm256_set1_epi8(char(0xDF));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    const __m256i codeTable = _mm256_setr_epi8(0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0,
+                                               0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i baseA = _mm256_set1_epi8('A'), baseC = _mm256_set1_epi8('C');
+    const __m256i baseG = _mm256_set1_epi8('G'), baseT = _mm256_set1_epi8('T');
+
+    size_t start = 0;
+    for (; start + 64 <= length; start += 64)
+    {
+        uint64_t valid = 0, lowercase = 0;
+        for (int half = 0; half < 2; half++)
+        {
+            __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(sequence + start + 32 * half));
+            __m256i upper = _mm256_and_si256(chars, caseMask);
+            __m256i isBase = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(upper, baseA), _mm256_cmpeq_epi8(upper, baseC)),
+                                             _mm256_or_si256(_mm256_cmpeq_epi8(upper, baseG), _mm256_cmpeq_epi8(upper, baseT)));
+            valid |= uint64_t(uint32_t(_mm256_movemask_epi8(isBase))) << (32 * half);
+            lowercase |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_slli_epi16(chars, 2)))) << (32 * half);
+            bases[start / 32 + half] = packCodesAVX2(_mm256_shuffle_epi8(codeTable, _mm256_and_si256(upper, nibbleMask)));
+        }
+        invalidBases[start / 64] = ~valid;
+        softMasked[start / 64] = lowercase & valid;
+    }
+    if (start < length)
+        packNucleotidesScalar(sequence + start, length - start, bases + start / 32, invalidBases + start / 64, softMasked + start / 64);
+}
+
+#endif
+
+struct PackKernelChoice
+{
+    PackKernel kernel;
+    const char *name;
+};
+
+inline PackKernelChoice selectPackKernel()
+{
+#ifdef NUCLEOTIDE_PACKER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {packNucleotidesAVX2, "avx2"};
+    if (__builtin_cpu_supports("sse4.2"))
+        return {packNucleotidesSSE42, "sse4.2"};
+#endif
+    return {packNucleotidesScalar, "scalar"};
+}
+
+// The best kernel for this CPU, picked on first use
+inline const PackKernelChoice &packKernel()
+{
+    static const PackKernelChoice choice = selectPackKernel();
+    return choice;
+}
+
+inline void packNucleotides(const char *sequence, size_t length, PackedSequence &packed)
+{
+    packed.resize(length);
+    packKernel().kernel(sequence, length, packed.bases.data(), packed.invalidBases.data(), packed.softMaskedBases.data());
+}
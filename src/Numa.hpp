@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Memory policies of set_mempolicy(2), as in <numaif.h>, which is part of libnuma's headers
+#define NUMA_MPOL_DEFAULT 0
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MPOL_INTERLEAVE 3
+
+using namespace std;
+
+// A NUMA node with memory and the CPUs this process may run on
+struct NumaNode
+{
+    int id;
+    vector<int> cpus;
+};
+
+// Parse a kernel CPU list such as "0-3,8,10-11"
+inline vector<int> parseCpuList(const string &list)
+{
+    vector<int> cpus;
+    stringstream ranges(list);
+    string range;
+    while (getline(ranges, range, ','))
+    {
+        if (range.empty() || range == "\n")
+            continue;
+        size_t dash = range.find('-');
+        int first = stoi(range.substr(0, dash));
+        int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// The nodes of /sys/devices/system/node that have memory and CPUs in this process's affinity
+// mask, in id order. Empty where the system does not describe its nodes (non-Linux)
+inline vector<NumaNode> numaNodes()
+{
+    vector<NumaNode> nodes;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return nodes;
+    ifstream memoryNodes("/sys/devices/system/node/has_memory");
+    string list;
+    if (!getline(memoryNodes, list))
+        return nodes;
+    for (int id : parseCpuList(list))
+    {
+        ifstream cpuList("/sys/devices/system/node/node" + to_string(id) + "/cpulist");
+        string cpus;
+        getline(cpuList, cpus);
+        NumaNode node{id, {}};
+        for (int cpu : parseCpuList(cpus))
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                node.cpus.push_back(cpu);
+        if (!node.cpus.empty())
+            nodes.push_back(node);
+    }
+#endif
+    return nodes;
+}
+
+// Let the calling thread (and threads it starts later) run only on the CPUs of node
+inline bool bindThreadToNode(const NumaNode &node)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : node.cpus)
+        CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// Set the policy of memory first touched by the calling thread (and threads it starts later):
+// NUMA_MPOL_PREFERRED takes one node, NUMA_MPOL_INTERLEAVE spreads pages over all of them,
+// NUMA_MPOL_DEFAULT (with no nodes) puts them on the node of the touching CPU again
+inline bool setMemoryPolicy(int mode, const vector<NumaNode> &nodes)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    int maxNode = 0;
+    for (const auto &node : nodes)
+        maxNode = max(maxNode, node.id + 1);
+    vector<unsigned long> mask((maxNode + 8 * sizeof(unsigned long) - 1) / (8 * sizeof(unsigned long)) + 1, 0);
+    for (const auto &node : nodes)
+        mask[node.id / (8 * sizeof(unsigned long))] |= 1ul << (node.id % (8 * sizeof(unsigned long)));
+    // the kernel reads maxnode - 1 bits
+    return syscall(SYS_set_mempolicy, mode, nodes.empty() ? nullptr : mask.data(), nodes.empty() ? 0 : mask.size() * 8 * sizeof(unsigned long) + 1) == 0;
+#else
+    return false;
+#endif
+}
@@ -10,6 +10,8 @@
 #include <cstdlib>
 #include <fstream>
 
+#include "NucleotidePacker.hpp"
+
 #define ZIP_BUFFER_SIZE 4096
 
 using namespace std;
@@ -27,6 +29,9 @@ public:
     vector<string> sequences;
 };
 
+// A reference window: sequence id, start, end and the packed bases of [start, end)
+using SequenceChunk = tuple<string, size_t, size_t, PackedSequence>;
+
 
 string reverseComplement(const string &kmer)
 {
@@ -132,31 +137,6 @@ vector<uint64_t> getCanonicalInts(const string &sequence, size_t kmerSize)
     return kmers;
 }
 
-vector<string> getCanonicalKmers(string &sequence, int kmerSize)
-{
-    vector<string> kmers;
-    if (sequence.size() < kmerSize)
-        return kmers;
-    transform(sequence.begin(), sequence.end(), sequence.begin(), ::toupper);
-    for (int i = 0; i <= sequence.size() - kmerSize; i++)
-    {
-        try
-        {
-            string kmer = sequence.substr(i, kmerSize);
-            if (kmer.find_first_not_of("ACGT") != string::npos)
-                continue;
-            string revComplement = reverseComplement(kmer);
-            string canonicalKmer = kmer > revComplement ? revComplement : kmer;
-            kmers.push_back(canonicalKmer);
-        }
-        catch (invalid_argument &e)
-        {
-            continue;
-        }
-    }
-    return kmers;
-}
-
 string decompressGzip(const string &filename)
 {
     cout << "Decompressing " << filename << endl;
@@ -262,7 +242,7 @@ ParseResult readSequenceFile(const string &filename, bool compressed = false)
 }
 
 void chunkSequences(const vector<string> &ids, const vector<string> &sequences, size_t chunkSize, size_t kmerSize,
-                    vector<tuple<string, size_t, size_t, string>> &chunks)
+                    vector<SequenceChunk> &chunks)
 {
     chunks.clear();
     for (size_t i = 0; i < sequences.size(); i++)
@@ -272,18 +252,12 @@ void chunkSequences(const vector<string> &ids, const vector<string> &sequences,
         for (size_t i = 0; i < sequence.size(); i += chunkSize - kmerSize)
         {
             size_t end;
-            string chunk;
             if (i + chunkSize > sequence.size())
-            {
                 end = sequence.size();
-                chunk = sequence.substr(i);
-            }
             else
-            {
                 end = i + chunkSize;
-                chunk = sequence.substr(i, chunkSize);
-            }
-            chunks.push_back(make_tuple(id, i, end, chunk));
+            chunks.emplace_back(id, i, end, PackedSequence());
+            packNucleotides(sequence.data() + i, end - i, get<3>(chunks.back()));
         }
     }
 }
\ No newline at end of file
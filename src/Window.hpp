@@ -1,18 +1,23 @@
 
 #include <cstddef>
+#include <string_view>
 
 class Window
 {
 public:
-    std::string id;
+    std::string_view id; // points at the id of the chunk the window was computed from
     int start;
     int end;
     int totalKmers;
     int observedKmers;
     int variations;
     int kmerDistance;
+    int ambiguousBases;
+    int softMaskedKmers;
+    int observedSoftMaskedKmers;
 
-    Window() : totalKmers(0), observedKmers(0), variations(0), kmerDistance(0) {}
+    Window() : totalKmers(0), observedKmers(0), variations(0), kmerDistance(0), ambiguousBases(0),
+               softMaskedKmers(0), observedSoftMaskedKmers(0) {}
 
     void addVariation(int gapSize, int kmerSize)
     {